@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "kernels.hpp"
+
+/*
+  revcomp --alphabet=dna|rna|FILE
+
+  dna is swmap. rna is the same but complements to U instead of T (U in input maps
+  to A in both). FILE has one mapping per line, # starts a comment:
+
+    A T         A and a -> T, unless a has its own line
+    a t         lowercase stays lowercase
+    * -         every byte without mapping (default _)
+
+  The result is compiled into complement_table, so SIMD kernels run it through the same
+  pshufb / vpermb tables as dna. That's why only bytes 0x40..0x7f (letters and @[\]^_`{|}~)
+  may have own mapping, everything else gets the `*` byte.
+
+  For --validate the alphabet is what has own mapping: dna/rna letters which don't map
+  to _, in a file the bytes (and other case of letters) with a line.
+*/
+
+namespace revcomp {
+
+static inline complement_table load_alphabet(const std::string &spec) {
+    if (spec == "dna")
+        return complement_table::from(swmap);
+    if (spec == "rna")
+        return complement_table::from([](uint8_t c) {
+            auto m = swmap(c);
+            return uint8_t(m == 'T' ? 'U' : m);
+        });
+
+    std::ifstream in(spec);
+    if (!in)
+        throw std::invalid_argument("alphabet " + spec + " is neither dna, rna nor a readable file");
+    std::array<uint8_t, 256> map{};
+    std::array<bool, 256> given{};
+    uint8_t other = '_';
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); number++) {
+        line = line.substr(0, line.find('#'));
+        auto first = line.find_first_not_of(" \t");
+        if (first == line.npos)
+            continue;
+        auto second = line.find_first_not_of(" \t", first + 1);
+        if (second == line.npos || line.find_first_not_of(" \t\r", second + 1) != line.npos ||
+            (line[first + 1] != ' ' && line[first + 1] != '\t'))
+            throw std::runtime_error(spec + ":" + std::to_string(number) + ": expected \"FROM TO\"");
+        auto from = uint8_t(line[first]), to = uint8_t(line[second]);
+        if (from == '*') {
+            other = to;
+            continue;
+        }
+        if ((from & 0xc0) != 0x40)
+            throw std::runtime_error(spec + ":" + std::to_string(number) +
+                                     ": only bytes 0x40..0x7f (letters) can be mapped");
+        map[from] = to;
+        given[from] = true;
+    }
+
+    auto letter = [](uint8_t c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; };
+    return complement_table::from(
+        [&](uint8_t c) {
+            if (given[c])
+                return map[c];
+            if (letter(c) && given[c ^ 0x20])
+                return map[c ^ 0x20];
+            return other;
+        },
+        [&](uint8_t c) { return given[c] || (letter(c) && given[c ^ 0x20]); });
+}
+
+}
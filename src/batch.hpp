@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+
+#include "engine_memory.hpp"
+
+/*
+  revcomp --batch=LIST - many files in one process.
+
+  LIST (- is stdin) has an "input output" pair of paths per line, blank lines and
+  lines starting with # are skipped. A process per file pays exec, config and buffer
+  setup every time, and its cores idle while one big file is finished by one thread.
+  Here all files go to one pool of pinned workers (topology.hpp), each with own
+  buffer reused for every block it does and own deque of tasks:
+
+    file   map input, index it (memory engine parse), create output, cut it into
+           ~write_batch blocks (job_cuts) and push them
+    block  transform_span of one block into worker's buffer, pwrite it at the same
+           offset of output - output offsets == input offsets, so blocks need no
+           order and no state of each other, whoever runs them
+
+  A file with a ragged record (fasta.hpp) has no such offsets after it, its file task
+  does it whole, in order, as single-threaded memory engine would.
+
+  Worker pops the newest task of its own deque and steals the oldest one of another
+  when it's empty. Files are dealt largest first, so every worker starts with its
+  biggest file while thieves take smallest ones - small files fill the gaps while a
+  big one is split into blocks, and blocks are stolen once no file is left. The
+  block which finishes a file last closes it.
+
+  Inputs are mapped without MAP_POPULATE, pages are faulted by the workers which
+  transform them. --validate reports as threaded memory engine does. Options which
+  need output in order or pick engine / output mode don't apply, --threads is the
+  pool size (default: cpus allowed by affinity and cgroup quota).
+
+  300 files of 450KB in /dev/shm: 0.21s, 2.0s as a process per file (1 cpu host).
+*/
+
+namespace revcomp {
+
+struct batch_file {
+    batch_file(std::string input, std::string output, size_t size)
+        : input(std::move(input)), output(std::move(output)), size(size) {}
+    batch_file(const batch_file&) = delete;
+    batch_file& operator=(const batch_file&) = delete;
+    ~batch_file() {
+        if (out != -1)
+            close(out);
+    }
+
+    std::string input, output;
+    size_t size;
+
+    // set by its file task
+    std::unique_ptr<mapping> data;
+    int out = -1;
+    std::vector<record> index;
+    size_t first = 0;
+    std::vector<size_t> cuts;
+    std::atomic<size_t> blocks_left{0};
+};
+
+using batch_list = std::vector<std::unique_ptr<batch_file>>;
+
+static inline batch_list read_batch_list(const std::string &path) {
+    std::ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file)
+            throw std::system_error(errno, std::generic_category(), path);
+    }
+    std::istream &in = path == "-" ? std::cin : file;
+    batch_list files;
+    std::string text;
+    for (size_t line = 1; std::getline(in, text); line++) {
+        std::istringstream words(text);
+        std::string input, output, extra;
+        if (!(words >> input) || input[0] == '#')
+            continue;
+        if (!(words >> output) || words >> extra)
+            throw std::invalid_argument(path + ":" + std::to_string(line) + ": expected input and output path");
+        struct stat in_stat, out_stat;
+        if (stat(input.c_str(), &in_stat))
+            throw std::system_error(errno, std::generic_category(), input);
+        if (!S_ISREG(in_stat.st_mode))
+            throw std::invalid_argument(input + " is not a regular file");
+        if (!stat(output.c_str(), &out_stat) && in_stat.st_dev == out_stat.st_dev && in_stat.st_ino == out_stat.st_ino)
+            throw std::invalid_argument(input + ": input and output are the same file");
+        files.push_back(std::make_unique<batch_file>(input, output, size_t(in_stat.st_size)));
+    }
+    return files;
+}
+
+template <class K = default_kernel>
+static void run_batch(batch_list &files, const tuning &tune, size_t threads, stats &st) {
+    constexpr size_t whole = ~size_t(0);
+    struct task {
+        batch_file *file;
+        size_t block;   // whole - file task
+    };
+    struct alignas(64) queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    auto topo = topology::host();
+    auto queues = std::make_unique<queue[]>(threads);
+    std::vector<batch_file*> order;
+    for (auto &f : files)
+        order.push_back(f.get());
+    std::stable_sort(order.begin(), order.end(), [](auto *a, auto *b) { return a->size > b->size; });
+    for (size_t i = 0; i < order.size(); i++)
+        queues[i % threads].tasks.push_front({order[i], whole});
+
+    std::atomic<size_t> pending{order.size()};  // tasks queued or running
+    std::atomic<uint32_t> pushed{0};            // bumped by every push and by the end, idle workers wait on it
+    std::atomic<bool> stop{false};
+    std::mutex done_lock;
+    std::exception_ptr error;
+
+    auto wake = [&] {
+        pushed.fetch_add(1);
+        pushed.notify_all();
+    };
+    auto next = [&](size_t t, task &x) {
+        for (size_t i = 0; i < threads; i++) {
+            auto &q = queues[(t + i) % threads];
+            std::lock_guard guard{q.lock};
+            if (q.tasks.empty())
+                continue;
+            x = i == 0 ? q.tasks.back() : q.tasks.front();
+            i == 0 ? q.tasks.pop_back() : q.tasks.pop_front();
+            return true;
+        }
+        return false;
+    };
+
+    auto worker = [&](size_t t) {
+        auto &cpu = topo.place(t);
+        pin_current_thread(cpu);
+        stats own{st.engine, st.enabled};
+        if (st.counting())
+            own.enable_perf();
+        std::unique_ptr<local_buffer> buffer;
+
+        auto finish_file = [&](batch_file &f) {
+            f.data.reset();
+            f.index = {};
+            f.cuts = {};
+            if (close(std::exchange(f.out, -1)))
+                throw std::system_error(errno, std::generic_category(), f.output);
+        };
+        auto run_block = [&](batch_file &f, size_t j) {
+            auto a = f.cuts[j], b = f.cuts[j + 1];
+            if (!buffer || buffer->size < b - a) {
+                buffer = std::make_unique<local_buffer>(std::max(b - a, tune.write_batch));
+                buffer->touch(topo, cpu.node);
+            }
+            {
+                phase_scope scope{own, phase::transform};
+                transform_span<K>(f.data->data, f.first, f.index, a, b, buffer->data, nullptr);
+                own.processed(phase::transform, b - a);
+            }
+            {
+                phase_scope scope{own, phase::write};
+                pwrite_all(f.out, buffer->data, b - a, off_t(a), own);
+            }
+            if (f.blocks_left.fetch_sub(1) == 1)
+                finish_file(f);
+        };
+        auto run_file = [&](batch_file &f) {
+            {
+                phase_scope scope{own, phase::read};
+                auto in = open(f.input.c_str(), O_RDONLY | O_CLOEXEC);
+                if (in == -1)
+                    throw std::system_error(errno, std::generic_category(), "open");
+                try {
+                    f.data = std::make_unique<mapping>(in, f.size, MAP_PRIVATE);
+                } catch (...) {
+                    close(in);
+                    throw;
+                }
+                close(in);
+                own.processed(phase::read, f.size);
+            }
+            f.out = open(f.output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            if (f.out == -1)
+                throw std::system_error(errno, std::generic_category(), f.output);
+            auto data = f.data->data;
+            bool ragged = false;
+            {
+                phase_scope scope{own, phase::index};
+                auto p = data ? (const char*)memchr(data, '>', f.size) : nullptr;
+                f.first = p ? p - data : f.size;
+                for (auto pos = f.first; pos < f.size; pos = f.index.back().next) {
+                    f.index.push_back(parse_record(data, f.size, pos));
+                    ragged |= f.index.back().ragged;
+                }
+                f.cuts = job_cuts(f.index, f.size, tune.write_batch);
+                own.processed(phase::index, f.size);
+            }
+            if (ragged) {
+                output_buffer ob{f.out, own, tune.write_batch};
+                phase_scope scope{own, phase::transform};
+                ob.put(data, f.first);
+                ragged_records<K> walk{ob, own, tune};
+                for (auto &r : f.index)
+                    r.ragged ? walk.put(data, r) : put_record<K>(data, r, ob, own, tune.tile);
+                ob.flush();
+                return finish_file(f);
+            }
+            own.records += f.index.size();
+            auto blocks = f.cuts.size() - 1;
+            if (blocks == 0)
+                return finish_file(f);
+            // block 0 is done right here as part of this task
+            f.blocks_left = blocks;
+            pending.fetch_add(blocks - 1);
+            if (blocks > 1) {
+                {
+                    std::lock_guard guard{queues[t].lock};
+                    for (auto j = blocks - 1; j > 0; j--)
+                        queues[t].tasks.push_back({&f, j});
+                }
+                wake();
+            }
+            run_block(f, 0);
+        };
+
+        task x;
+        while (!stop) {
+            auto seen = pushed.load();
+            if (!next(t, x)) {
+                if (pending == 0)
+                    break;
+                pushed.wait(seen);
+                continue;
+            }
+            try {
+                x.block == whole ? run_file(*x.file) : run_block(*x.file, x.block);
+            } catch (const std::exception &e) {
+                std::lock_guard guard{done_lock};
+                if (!error)
+                    error = std::make_exception_ptr(std::runtime_error(x.file->input + ": " + e.what()));
+                stop = true;
+                wake();
+                break;
+            }
+            if (pending.fetch_sub(1) == 1)
+                wake();
+        }
+        std::lock_guard guard{done_lock};
+        st.add(own);
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.emplace_back(worker, t);
+    for (auto &w : workers)
+        w.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <sys/mman.h>
+#include <vector>
+
+#include "engine_pread.hpp"
+#include "tuning.hpp"
+
+/*
+  revcomp --calibrate
+
+  Synthetic 64MB FASTA in memfd: two 24MB records + short ~200bp ones, 60 residues/line.
+  It goes through pread engine memfd -> memfd, so only page cache is involved, no disk.
+
+  Candidates are picked around cache sizes of the host (L1d/L2 from sysconf or sysfs).
+  We go size by size and keep the best value found so far (coordinate descent, 2 rounds),
+  every point is best of 3 runs and must win by 2% to replace current best (noise). Full grid would be ~1000 runs and neighbours differ
+  by few % anyway.
+*/
+
+namespace revcomp {
+
+class memfd {
+public:
+    explicit memfd(const char *name) : fd(memfd_create(name, 0)) {
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), "memfd_create");
+    }
+    memfd(const memfd&) = delete;
+    memfd& operator=(const memfd&) = delete;
+    ~memfd() { close(fd); }
+
+    const int fd;
+};
+
+// alphabet - residues are drawn uniformly from it
+static inline std::string synthetic_fasta(size_t size, std::string_view alphabet = "ACGT") {
+    std::string data;
+    data.reserve(size + 4096);
+    uint64_t x = 88172645463325252ULL;
+    auto residue = [&] {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        return alphabet[x % alphabet.size()];
+    };
+    auto add_record = [&](size_t n) {
+        data += ">synthetic " + std::to_string(data.size()) + "\n";
+        for (size_t i = 0; i < n; i++) {
+            data += residue();
+            if (i % 60 == 59 || i + 1 == n)
+                data += '\n';
+        }
+    };
+    add_record(size * 3 / 8);
+    add_record(size * 3 / 8);
+    while (data.size() < size)
+        add_record(100 + (x & 255));
+    return data;
+}
+
+static inline std::vector<size_t> candidates(std::vector<size_t> sizes) {
+    std::erase_if(sizes, [](size_t s) { return s < (4 << 10) || s > (64 << 20); });
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    return sizes;
+}
+
+static inline tuning calibrate(FILE *log) {
+    constexpr size_t input_size = 64 << 20;
+    constexpr int repeats = 3;
+    auto caches = host_caches();
+    fprintf(log, "caches: L1d %zuK, L2 %zuK, L3 %zuK\n", caches.l1d >> 10, caches.l2 >> 10,
+            caches.l3 >> 10);
+
+    memfd input{"revcomp-calibrate-in"}, output{"revcomp-calibrate-out"};
+    auto data = synthetic_fasta(input_size);
+    stats quiet{"calibrate"};
+    write_all(input.fd, data.data(), data.size(), quiet);
+
+    auto measure = [&](const tuning &t) {
+        uint64_t best = ~0ULL;
+        for (int i = 0; i < repeats; i++) {
+            if (ftruncate(output.fd, 0) || lseek(output.fd, 0, SEEK_SET))
+                throw std::system_error(errno, std::generic_category(), "ftruncate");
+            auto t0 = monotonic_now();
+            output_buffer ob{output.fd, quiet, t.write_batch};
+            run_pread(input.fd, ob, data.size(), t, quiet);
+            best = std::min(best, monotonic_now() - t0);
+        }
+        return double(data.size()) / double(best);
+    };
+
+    auto l1 = caches.l1d, l2 = caches.l2;
+    struct dimension {
+        const char *name;
+        size_t tuning::*field;
+        std::vector<size_t> values;
+    };
+    std::vector<dimension> grid = {
+        {"read_chunk", &tuning::read_chunk,
+         candidates({16 << 10, 32 << 10, 64 << 10, 128 << 10, 256 << 10, l2 / 2, l2, 4 << 20})},
+        {"index_block", &tuning::index_block,
+         candidates({16 << 10, 32 << 10, 64 << 10, 128 << 10, l2 / 2})},
+        {"tile", &tuning::tile, candidates({l1 / 2, l1, 2 * l1, l2 / 4, l2 / 2, l2})},
+        {"write_batch", &tuning::write_batch,
+         candidates({256 << 10, 1 << 20, l2, 4 << 20, 16 << 20})},
+    };
+
+    tuning best;
+    auto best_gbps = measure(best);
+    fprintf(log, "defaults: %.2f GB/s\n", best_gbps);
+    for (int round = 0; round < 2; round++) {
+        for (auto &dim : grid) {
+            for (auto value : dim.values) {
+                if (value == best.*dim.field)
+                    continue;
+                auto t = best;
+                t.*dim.field = value;
+                auto gbps = measure(t);
+                fprintf(log, "  %-12s %9zu  %.2f GB/s\n", dim.name, value, gbps);
+                if (gbps > best_gbps * 1.02) {
+                    best_gbps = gbps;
+                    best = t;
+                }
+            }
+        }
+    }
+    fprintf(log, "best: read_chunk %zu, index_block %zu, tile %zu, write_batch %zu - %.2f GB/s\n",
+            best.read_chunk, best.index_block, best.tile, best.write_batch, best_gbps);
+    return best;
+}
+
+}
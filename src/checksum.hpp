@@ -0,0 +1,227 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <immintrin.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "fasta.hpp"
+
+/*
+  revcomp --checksums=PATH --verify=PATH
+
+  CRC32C (Castagnoli, same as iSCSI/ext4/crc32c tools) of every output record and of
+  the whole output, taken by output_buffer on each commit/put - the bytes were just
+  written by the kernel and are still in L1/L2, so there is no second pass over output
+  and no re-read of the file to check it.
+
+  Record and total are two chains over the same words: crc32 has latency 3 and
+  throughput 1, one chain leaves the unit idle 2 cycles of 3, so the second one is
+  ~free and no crc combine (GF(2) shift per record) is needed. Without SSE4.2 it's
+  table driven. Threaded memory engine checksums in its ordered writer, jobs are cut
+  at record ends there.
+
+  245MB, 72000 records to /dev/null: +35..50ms in every engine (~6GB/s).
+
+  PATH is TSV, one row per record and a last `*` row for the whole output:
+
+    name    bytes   crc32c
+    ONE     2056    e79b1451
+    TWO     3075    5f2201aa
+    THREE   5114    ef80fe0c
+    *       10245   d3a4c849
+
+  bytes are output bytes of the record (header, body, trailing newline), bytes before
+  the first '>' count only in total. --checksums writes it (- is stderr), --verify
+  compares with one written before and fails on the first record which differs, or
+  at the end if total or number of records does.
+*/
+
+namespace revcomp {
+
+constexpr uint32_t crc32c_poly = 0x82f63b78;  // reflected 0x1edc6f41
+
+constexpr auto crc32c_table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; i++) {
+        auto c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? c >> 1 ^ crc32c_poly : c >> 1;
+        t[i] = c;
+    }
+    return t;
+}();
+
+// both raw (not inverted) crcs a and b extended with p[0, n)
+static inline void crc32c_update2(uint32_t &a, uint32_t &b, const char *p, size_t n) {
+#ifdef __SSE4_2__
+    uint64_t x = a, y = b;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        x = _mm_crc32_u64(x, v);
+        y = _mm_crc32_u64(y, v);
+    }
+    a = uint32_t(x);
+    b = uint32_t(y);
+    for (; n; p++, n--) {
+        a = _mm_crc32_u8(a, uint8_t(*p));
+        b = _mm_crc32_u8(b, uint8_t(*p));
+    }
+#else
+    for (; n; p++, n--) {
+        a = a >> 8 ^ crc32c_table[(a ^ uint8_t(*p)) & 0xff];
+        b = b >> 8 ^ crc32c_table[(b ^ uint8_t(*p)) & 0xff];
+    }
+#endif
+}
+
+class output_checksums {
+public:
+    // empty path - that side is off
+    output_checksums(const std::string &write_path, const std::string &verify_path)
+        : verify_path(verify_path) {
+        if (!write_path.empty()) {
+            out = write_path == "-" ? stderr : fopen(write_path.c_str(), "w");
+            if (!out)
+                throw std::system_error(errno, std::generic_category(), write_path);
+            fputs("name\tbytes\tcrc32c\n", out);
+        }
+        if (!verify_path.empty())
+            load(verify_path);
+    }
+    output_checksums(const output_checksums&) = delete;
+    output_checksums& operator=(const output_checksums&) = delete;
+    ~output_checksums() {
+        if (out && out != stderr)
+            fclose(out);
+    }
+
+    void add(const char *p, size_t n) {
+        crc32c_update2(total, current, p, n);
+        total_bytes += n;
+        current_bytes += n;
+    }
+
+    // whole output so far
+    uint64_t bytes() const { return total_bytes; }
+    uint32_t crc() const { return ~total; }
+
+    // bytes so far are not a record (text before the first '>')
+    void end_preamble() {
+        current = ~0u;
+        current_bytes = 0;
+    }
+
+    // bytes since previous end are record with this header line
+    void end_record(std::string_view header) {
+        auto name = record_name(header);
+        auto crc = ~current;
+        if (out)
+            row(name, current_bytes, crc);
+        if (!verify_path.empty()) {
+            if (records + 1 >= expected.size())
+                throw std::runtime_error("record " + std::string(name) + ": not in " + verify_path +
+                                         ", output has more records");
+            auto &e = expected[records];
+            if (e.crc != crc || e.bytes != current_bytes)
+                throw std::runtime_error("record " + std::string(name) + ": " + describe(crc, current_bytes) +
+                                         ", expected " + describe(e.crc, e.bytes) + " (" + verify_path +
+                                         ":" + std::to_string(records + 2) + ")");
+        }
+        records++;
+        end_preamble();
+    }
+
+    // whole output is done: total row, check total and count, close
+    void finish() {
+        auto crc = ~total;
+        if (out) {
+            row("*", total_bytes, crc);
+            auto failed = fflush(out) != 0 || ferror(out);
+            auto err = errno;
+            if (out != stderr)
+                failed |= fclose(out) != 0;
+            out = nullptr;
+            if (failed)
+                throw std::system_error(err, std::generic_category(), "--checksums");
+        }
+        if (verify_path.empty())
+            return;
+        if (records + 1 != expected.size())
+            throw std::runtime_error("output has " + std::to_string(records) + " records, " + verify_path +
+                                     " has " + std::to_string(expected.size() - 1));
+        auto &e = expected.back();
+        if (e.crc != crc || e.bytes != total_bytes)
+            throw std::runtime_error("output: " + describe(crc, total_bytes) + ", expected " +
+                                     describe(e.crc, e.bytes));
+    }
+
+private:
+    struct entry {
+        uint64_t bytes;
+        uint32_t crc;
+    };
+
+    static std::string describe(uint32_t crc, uint64_t bytes) {
+        char hex[16];
+        snprintf(hex, sizeof hex, "%08x", crc);
+        return "crc32c " + std::string(hex) + " of " + std::to_string(bytes) + " bytes";
+    }
+
+    // rows after the header line, the last one is total
+    void load(const std::string &path) {
+        std::ifstream in(path);
+        if (!in)
+            throw std::system_error(errno, std::generic_category(), path);
+        std::string line;
+        for (size_t number = 1; std::getline(in, line); number++) {
+            if (number == 1 && line.starts_with("name\t"))
+                continue;
+            // numbers are the last two columns
+            auto parse = [&](size_t from, size_t to, auto &value, int base) {
+                auto end = line.data() + to;
+                return from < to && std::from_chars(line.data() + from, end, value, base).ptr == end;
+            };
+            auto crc_tab = line.rfind('\t');
+            auto bytes_tab = crc_tab == line.npos || crc_tab == 0 ? line.npos : line.rfind('\t', crc_tab - 1);
+            entry e;
+            if (bytes_tab == line.npos || !parse(bytes_tab + 1, crc_tab, e.bytes, 10) ||
+                !parse(crc_tab + 1, line.size(), e.crc, 16))
+                throw std::runtime_error(path + ":" + std::to_string(number) + ": expected \"name\\tbytes\\tcrc32c\"");
+            expected.push_back(e);
+        }
+        if (expected.empty())
+            throw std::runtime_error(path + ": no checksums");
+    }
+
+    void row(std::string_view name, uint64_t bytes, uint32_t crc) {
+        line.assign(name).append("\t");
+        char number[32];
+        line.append(number, std::to_chars(number, std::end(number), bytes).ptr);
+        line.append("\t00000000");
+        auto hex = std::to_chars(number, std::end(number), crc, 16).ptr;
+        line.replace(line.size() - (hex - number), hex - number, number, hex - number);
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), out);
+    }
+
+    FILE *out = nullptr;
+    std::string verify_path;
+    std::vector<entry> expected;
+    std::string line;
+    uint32_t total = ~0u, current = ~0u;
+    uint64_t total_bytes = 0, current_bytes = 0;
+    size_t records = 0;
+};
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+/*
+  Complement tables shared by cpp-7 and revcomp engines.
+  swmap is the reference mapping, everything else is derived from it.
+*/
+
+namespace revcomp {
+
+constexpr uint8_t swmap(uint8_t c) {
+  switch(c) {
+    case 'A': case 'a': return 'T';// 'A' | 'a' => 'T',
+    case 'C': case 'c': return 'G';// 'C' | 'c' => 'G',
+    case 'G': case 'g': return 'C';// 'G' | 'g' => 'C',
+    case 'T': case 't': return 'A';// 'T' | 't' => 'A',
+    case 'U': case 'u': return 'A';// 'U' | 'u' => 'A',
+    case 'M': case 'm': return 'K';// 'M' | 'm' => 'K',
+    case 'R': case 'r': return 'Y';// 'R' | 'r' => 'Y',
+    case 'W': case 'w': return 'W';// 'W' | 'w' => 'W',
+    case 'S': case 's': return 'S';// 'S' | 's' => 'S',
+    case 'Y': case 'y': return 'R';// 'Y' | 'y' => 'R',
+    case 'K': case 'k': return 'M';// 'K' | 'k' => 'M',
+    case 'V': case 'v': return 'B';// 'V' | 'v' => 'B',
+    case 'H': case 'h': return 'D';// 'H' | 'h' => 'D',
+    case 'D': case 'd': return 'H';// 'D' | 'd' => 'H',
+    case 'B': case 'b': return 'V';// 'B' | 'b' => 'V',
+    case 'N': case 'n': return 'N';// 'N' | 'n' => 'N',
+    default: return '_';
+  }
+}
+
+// for 2B replacements, LUT computed in complile time? --dj
+// using hana: https://www.boost.org/doc/libs/1_61_0/libs/hana/doc/html/index.html
+constexpr auto map = ([] {
+  constexpr auto max = std::numeric_limits<uint8_t>::max() + size_t{1};
+  std::array<uint16_t, max * max> map{};
+  for(size_t it = 0; it < map.size(); ++it) {
+    uint8_t hi = (it >> 8), lo = it;
+    map[it] = (swmap(lo) << 8) | (swmap(hi));
+  }
+  return map;
+})();
+
+constexpr auto map256 = ([] {
+  constexpr auto max = std::numeric_limits<uint8_t>::max() + size_t{1};
+  std::array<uint8_t, max> map{};
+  for(size_t it = 0; it < max; ++it)
+    map[it] = swmap(it);
+  return map;
+})();
+
+// reverse-complement n bytes which end at src_end (we go backward) into dst, 2B at once
+static inline void reverse_complement(const char *src_end, char *dst, size_t n) {
+  for(; n >= 2; n -= 2, dst += 2) {
+    uint16_t v;
+    memcpy(&v, src_end -= 2, 2);
+    memcpy(dst, &map[v], 2);
+  }
+  if(n) *dst = map256[uint8_t(*--src_end)];
+}
+
+}
@@ -10,6 +10,7 @@
 #include<unistd.h>
 #undef NDEBUG
 #include<cassert>
+#include<cerrno>
 #include<filesystem>
 #include<string_view>
 #include<vector>
@@ -20,6 +21,10 @@
 #include<sys/sendfile.h>
 #include<string.h>
 
+#include"complement.hpp"
+#include"output.hpp"
+#include"stats.hpp"
+
 // --dj Just for hana literals and llong_c
 namespace hana = boost::hana;
 // --dj just for fs::path ?
@@ -32,47 +37,8 @@ using namespace std::literals;
 using hana::_;
 
 namespace {
-constexpr uint8_t swmap(uint8_t c) {
-  switch(c) {
-    case 'A': case 'a': return 'T';// 'A' | 'a' => 'T',
-    case 'C': case 'c': return 'G';// 'C' | 'c' => 'G',
-    case 'G': case 'g': return 'C';// 'G' | 'g' => 'C',
-    case 'T': case 't': return 'A';// 'T' | 't' => 'A',
-    case 'U': case 'u': return 'A';// 'U' | 'u' => 'A',
-    case 'M': case 'm': return 'K';// 'M' | 'm' => 'K',
-    case 'R': case 'r': return 'Y';// 'R' | 'r' => 'Y',
-    case 'W': case 'w': return 'W';// 'W' | 'w' => 'W',
-    case 'S': case 's': return 'S';// 'S' | 's' => 'S',
-    case 'Y': case 'y': return 'R';// 'Y' | 'y' => 'R',
-    case 'K': case 'k': return 'M';// 'K' | 'k' => 'M',
-    case 'V': case 'v': return 'B';// 'V' | 'v' => 'B',
-    case 'H': case 'h': return 'D';// 'H' | 'h' => 'D',
-    case 'D': case 'd': return 'H';// 'D' | 'd' => 'H',
-    case 'B': case 'b': return 'V';// 'B' | 'b' => 'V',
-    case 'N': case 'n': return 'N';// 'N' | 'n' => 'N',
-    default: return '_';
-  }
-}
-
-// for 2B replacements, LUT computed in complile time? --dj
-// using hana: https://www.boost.org/doc/libs/1_61_0/libs/hana/doc/html/index.html
-constexpr auto map = ([] {
-  constexpr auto max = std::numeric_limits<uint8_t>::max() + size_t{1};
-  std::array<uint16_t, max * max> map{};
-  for(size_t it = 0; it < map.size(); ++it) {
-    uint8_t hi = (it >> 8), lo = it;
-    map[it] = (swmap(lo) << 8) | (swmap(hi));
-  }
-  return map;
-})();
-
-constexpr auto map256 = ([] {
-  constexpr auto max = std::numeric_limits<uint8_t>::max() + size_t{1};
-  std::array<uint8_t, max> map{};
-  for(size_t it = 0; it < max; ++it)
-    map[it] = swmap(it);
-  return map;
-})();
+using revcomp::map;
+using revcomp::map256;
 
 template<size_t noffset> void replace60(const char * in, char * out) {
   constexpr auto offset = hana::llong_c<noffset>;
@@ -138,83 +104,154 @@ sendfile
 */
 
 
-void replace(int fd, range r) {
+// pread counted in st, a failed one aborts like every other check here (-1 is not bytes)
+ssize_t counted_pread(int fd, void * buf, size_t n, off_t offset, revcomp::phase ph, revcomp::stats & st) {
+  ssize_t bytes;
+  do bytes = pread(fd, buf, n, offset); while(bytes < 0 && errno == EINTR);
+  assert(bytes >= 0);
+  st.syscall(ph, bytes);
+  return bytes;
+}
+
+using replace60_fn = decltype(replace60<0>) *;
+
+// reverse-complement `size` bytes of sequence which ends at `in` (we go backward) into `out`
+void replace(replace60_fn op, const char * in, char * out, size_t size) {
+  constexpr size_t line_size = 61;
+  for(size_t n = 0; n < size / line_size; ++n) {
+    op(in, out); in -= line_size; out += line_size;
+  }
+  for(size_t n = 0; n < size % line_size; ++n) {
+    *out++ = map256[uint8_t(*(--in))];
+  }
+}
+
+void replace(int fd, range r, revcomp::output_buffer & out, revcomp::stats & st) {
+  using revcomp::phase, revcomp::phase_scope;
   auto op = select_replace60(r);
   constexpr size_t line_size = 61;
   constexpr size_t block_size = line_size * 1024;
-  char buf[block_size]{};
-  char outbuf[block_size]{};
+  char buf[block_size];
   auto nblock = r.size / block_size;
   auto tail = r.size - (nblock * block_size);
 
   for(size_t n = 1; n <= nblock; ++n) {
-    pread(fd, buf, block_size, r.begin + r.size - n * block_size);
-    auto it = std::end(buf), oit = std::begin(outbuf), oend = std::end(outbuf);
-    while(oit < oend) {
-      op(it, oit); it -= line_size; oit += line_size;
+    {
+      phase_scope scope{st, phase::read};
+      counted_pread(fd, buf, block_size, r.begin + r.size - n * block_size, phase::read, st);
     }
-    write(STDOUT_FILENO, outbuf, block_size);
-  }
-
-  pread(fd, buf, tail, r.begin);
-  auto it = std::begin(buf) + tail, oit = std::begin(outbuf);
-
-  for(size_t n = 0; n < tail / line_size; ++n) {
-    op(it, oit); it -= line_size; oit += line_size;
+    auto o = out.reserve(block_size);
+    phase_scope scope{st, phase::transform};
+    replace(op, std::end(buf), o, block_size);
+    st.processed(phase::transform, block_size);
+    out.commit(block_size);
   }
 
-  for(size_t n = 0; n < (tail - (tail / line_size) * line_size); ++n) {
-    *oit++ = map256[*(--it)];
+  {
+    phase_scope scope{st, phase::read};
+    counted_pread(fd, buf, tail, r.begin, phase::read, st);
   }
-
-  write(STDOUT_FILENO, outbuf, tail);
-  write(STDOUT_FILENO, "\n", 1);
+  auto o = out.reserve(tail + 1);
+  phase_scope scope{st, phase::transform};
+  replace(op, std::begin(buf) + tail, o, tail);
+  o[tail] = '\n';
+  st.processed(phase::transform, tail);
+  out.commit(tail + 1);
 }
 
+/*
+  find_first_of used to pread 32KB for every search so with short records the same
+  block was read ~3 times per record. scanner keeps last block around.
+*/
+class scanner {
+public:
+  scanner(int fd, revcomp::stats & st) : fd(fd), st(st) {}
+
+  size_t find_first_of(char c, size_t pos, size_t & endfile) {
+    if(pos == sv::npos) return pos;
+    while(true) {
+      if(pos < begin || pos >= begin + bytes) {
+        auto n = counted_pread(fd, mem, block_size, pos, revcomp::phase::index, st);
+        begin = pos; bytes = n;
+        if(!bytes) { endfile = pos; return sv::npos; }
+      }
+      auto r = sv{(const char *)mem + (pos - begin), bytes - (pos - begin)}.find_first_of(c);
+      if(r != sv::npos) return pos + r;
+      pos = begin + bytes;
+    }
+  }
 
-auto find_first_of(int fd, char c, size_t pos, size_t & endfile) {
-  constexpr size_t block_size = 1024 * 32;
+private:
+  static constexpr size_t block_size = 1024 * 32;
+  int fd;
+  revcomp::stats & st;
   uint8_t mem[block_size]{};
-  if(pos == sv::npos) return pos;
-  while(true) {
-    auto bytes = pread(fd, mem, block_size, pos);
-    assert(bytes >= 0);
-    if(!bytes) { endfile = pos; return sv::npos; }
-    auto r = sv{(const char *)mem, size_t(bytes)}.find_first_of(c);
-    if(r != sv::npos) return pos + r;
-    pos += bytes;
-  }
-}
+  size_t begin{}, bytes{};
+};
 
-int main() {
+int main(int argc, char ** argv) {
+  using revcomp::phase, revcomp::phase_scope;
+  revcomp::stats st{"cpp-7", argc, argv};
   fs::path path{"/dev/stdin"};
   int fd = open(path.c_str(), O_RDONLY);
   assert(fd != -1);
-  auto start = std::chrono::high_resolution_clock::now();
 
-
-  auto next = [=, prev = 0ul]() mutable -> std::pair<range, range> {
+  scanner scan{fd, st};
+  auto next = [&, prev = 0ul]() mutable -> std::pair<range, range> {
     size_t endfile{};
-    auto arrow_pos = find_first_of(fd, '>', prev, endfile);
-    auto begin_pos = find_first_of(fd, '\n', arrow_pos, endfile);
+    auto arrow_pos = scan.find_first_of('>', prev, endfile);
+    auto begin_pos = scan.find_first_of('\n', arrow_pos, endfile);
     if(begin_pos == sv::npos) return {};
-    prev = find_first_of(fd, '>', begin_pos, endfile);
+    prev = scan.find_first_of('>', begin_pos, endfile);
     prev = (prev == sv::npos) ? endfile : prev;
     return {{arrow_pos, begin_pos - arrow_pos + 1}, {begin_pos + 1, prev - begin_pos - 2}};
   };
 
   std::vector<std::pair<range, range>> index;
-  for(auto pair = next(); pair != std::pair<range, range>{}; pair = next()) index.emplace_back(pair);
-
-//   fprintf(stderr, "%.3f\n", std::chrono::duration<double>{std::chrono::high_resolution_clock::now() - start}.count());
-
-  start = std::chrono::high_resolution_clock::now();
-
-  for(auto [h, q]: index) {
-    off_t begin = h.begin;
-    sendfile(STDOUT_FILENO, fd, &begin, h.size);
-    replace(fd, q);
-  };
+  {
+    phase_scope scope{st, phase::index};
+    for(auto pair = next(); pair != std::pair<range, range>{}; pair = next()) index.emplace_back(pair);
+  }
+  st.records = index.size();
+
+  // records which fit in batch together are read with one pread, bigger ones block by block
+  constexpr size_t batch_size = 1 << 22;
+  std::vector<char> batch(batch_size);
+  revcomp::output_buffer out{STDOUT_FILENO, st};
+  auto span_end = [&](size_t i) { return index[i].second.begin + index[i].second.size + 1; };
+
+  for(size_t i = 0; i < index.size();) {
+    auto first = index[i].first.begin;
+    auto last = i;
+    while(last < index.size() && span_end(last) - first <= batch_size) ++last;
+
+    if(last == i) {
+      auto [h, q] = index[i++];
+      {
+        auto o = out.reserve(h.size);
+        phase_scope scope{st, phase::read};
+        counted_pread(fd, o, h.size, h.begin, phase::read, st);
+      }
+      out.commit(h.size);
+      replace(fd, q, out, st);
+      continue;
+    }
 
-//   fprintf(stderr, "%.3f\n", std::chrono::duration<double>{std::chrono::high_resolution_clock::now() - start}.count());
+    {
+      phase_scope scope{st, phase::read};
+      counted_pread(fd, batch.data(), span_end(last - 1) - first, first, phase::read, st);
+    }
+    phase_scope scope{st, phase::transform};
+    for(; i < last; ++i) {
+      auto [h, q] = index[i];
+      out.append(batch.data() + (h.begin - first), h.size);
+      auto o = out.reserve(q.size + 1);
+      replace(select_replace60(q), batch.data() + (q.begin + q.size - first), o, q.size);
+      o[q.size] = '\n';
+      out.commit(q.size + 1);
+      st.processed(phase::transform, q.size);
+    }
+  }
+  out.flush();
+  st.print_json(stderr);
 }
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/*
+  revcompd wire protocol, SOCK_STREAM unix socket, little-endian integers.
+
+    request:   u32 size | u32 id | u64 start | u64 end | u16 reference | u16 sequence
+               | reference name | sequence name
+    response:  u32 size | u32 id | u32 status | payload
+
+  size counts bytes after itself. With status ok payload is reverse-complement of
+  residues [start, end) (0-based, end exclusive) of the sequence, no newlines; other
+  status has error message as payload. Requests may be pipelined, responses of one
+  connection come in order of its requests. id is only echoed back.
+*/
+
+namespace revcomp {
+
+static_assert(std::endian::native == std::endian::little, "protocol is little-endian");
+
+enum class reply_status : uint32_t { ok = 0, not_found = 1, bad_range = 2, bad_request = 3 };
+
+struct region_request {
+    uint32_t id = 0;
+    uint64_t start = 0, end = 0;
+    std::string_view reference, sequence;
+};
+
+constexpr size_t request_head = 4 + 4 + 8 + 8 + 2 + 2;
+constexpr size_t response_head = 4 + 4 + 4;
+constexpr size_t max_region = 64 << 20;     // residues of one response
+
+template <class T>
+static inline T load_le(const char *p) {
+    T v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+template <class T>
+static inline char *store_le(char *p, T v) {
+    memcpy(p, &v, sizeof v);
+    return p + sizeof v;
+}
+
+static inline void encode_request(std::string &out, const region_request &r) {
+    if (r.reference.size() > 0xffff || r.sequence.size() > 0xffff)
+        throw std::invalid_argument("name longer than 64KB");
+    auto at = out.size();
+    out.resize(at + request_head + r.reference.size() + r.sequence.size());
+    auto p = store_le(out.data() + at, uint32_t(out.size() - at - 4));
+    p = store_le(p, r.id);
+    p = store_le(p, r.start);
+    p = store_le(p, r.end);
+    p = store_le(p, uint16_t(r.reference.size()));
+    p = store_le(p, uint16_t(r.sequence.size()));
+    memcpy(p, r.reference.data(), r.reference.size());
+    memcpy(p + r.reference.size(), r.sequence.data(), r.sequence.size());
+}
+
+// one request from [p, p + n) (names point into it), bytes it took, 0 if it's not all there yet
+static inline size_t decode_request(const char *p, size_t n, region_request &r) {
+    if (n < 4)
+        return 0;
+    auto size = load_le<uint32_t>(p);
+    if (size < request_head - 4 || size > request_head - 4 + 2 * 0xffff)
+        throw std::runtime_error("bad request size " + std::to_string(size));
+    if (n < 4 + size)
+        return 0;
+    r.id = load_le<uint32_t>(p + 4);
+    r.start = load_le<uint64_t>(p + 8);
+    r.end = load_le<uint64_t>(p + 16);
+    auto reference = load_le<uint16_t>(p + 24), sequence = load_le<uint16_t>(p + 26);
+    if (request_head + reference + sequence != 4 + size)
+        throw std::runtime_error("bad request name sizes");
+    r.reference = {p + request_head, reference};
+    r.sequence = {p + request_head + reference, sequence};
+    return 4 + size;
+}
+
+// response head for payload bytes, payload goes right after it
+static inline char *encode_response(std::string &out, uint32_t id, reply_status status, size_t payload) {
+    auto at = out.size();
+    out.resize(at + response_head + payload);
+    auto p = store_le(out.data() + at, uint32_t(response_head - 4 + payload));
+    p = store_le(p, id);
+    return store_le(p, uint32_t(status));
+}
+
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#include "parallel.hpp"
+#include "stats.hpp"
+
+/*
+  Output file written with O_DIRECT (--output=direct).
+
+  write() of GBs goes through page cache: every output page pushes out a page which
+  somebody else (other jobs on the host, our own input) may still want, and it's
+  written back later at whatever pace writeback picks. data/README: "cp to existing
+  - only ~150MB/s - it use SSD instead page cache". Here the file is reopened with
+  O_DIRECT and output goes straight from our buffers to the device.
+
+  Two page-aligned slots of ~write_batch (spsc_ring of 2): output_buffer fills one in
+  place (reserve/commit as with mapped output) while the writer thread pwrite()s the
+  other, so transform and device run at the same time. O_DIRECT wants offsets,
+  lengths and memory aligned to the logical block - `align` (4KB) covers what disks
+  have - so a slot is written up to its last whole block and the rest is copied to
+  the front of the next slot. The unaligned tail of the whole output goes with one
+  buffered pwrite at the end.
+
+  With --drop-input-cache the writer also posix_fadvise(DONTNEED)s input [0, E) once
+  output [0, E) is on disk: output offsets == input offsets and records go out
+  whole, so that input is consumed (pread engine reads the current record from its
+  end, a part of it may be dropped before it's read - it's read again, nothing more).
+  Pages mapped by memory engine are skipped by the kernel, pipes are ignored.
+
+  big.fa (245MB, input cached) to ext4 on virtio disk, until sync returns: write
+  363ms and +239MB of page cache, map 372ms and +239MB, direct 280ms and +4MB; with
+  --drop-input-cache pread and stream engines leave 8KB of the input cached.
+
+  nullptr from open() when the fd can't do it: not a regular file, O_APPEND, offset
+  > 0 or a filesystem without O_DIRECT.
+*/
+
+namespace revcomp {
+
+// pwrite all n bytes at offset, retry on short writes and EINTR
+static inline void pwrite_all(int fd, const char *p, size_t n, off_t offset, stats &st) {
+    while (n) {
+        auto bytes = pwrite(fd, p, n, offset);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "pwrite");
+        }
+        st.syscall(phase::write, bytes);
+        p += bytes;
+        n -= bytes;
+        offset += bytes;
+    }
+}
+
+class direct_output {
+public:
+    static constexpr size_t align = 4096;
+
+    // drop_input: input fd for --drop-input-cache, -1 - off
+    static std::unique_ptr<direct_output> open(int fd, size_t slot_size, int drop_input, stats &st) {
+        struct stat out_stat;
+        auto flags = fcntl(fd, F_GETFL);
+        if (fstat(fd, &out_stat) || !S_ISREG(out_stat.st_mode) || flags < 0 || (flags & O_APPEND) ||
+            lseek(fd, 0, SEEK_CUR) != 0)
+            return nullptr;
+        auto direct = ::open(("/proc/self/fd/" + std::to_string(fd)).c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        if (direct < 0)
+            return nullptr;
+        return std::unique_ptr<direct_output>(new direct_output(fd, direct, slot_size, drop_input, st));
+    }
+    direct_output(const direct_output&) = delete;
+    direct_output& operator=(const direct_output&) = delete;
+
+    ~direct_output() {
+        if (writer.joinable()) {
+            ring.close();
+            writer.join();
+        }
+        close(direct);
+    }
+
+    // space for n bytes at the end of output, end() is where it starts
+    char *reserve(size_t n) {
+        if (!current || current->used + n > current->buffer->size)
+            next_slot(n);
+        return end();
+    }
+    char *end() { return current->buffer->data + current->used; }
+    void commit(size_t n) { current->used += n; }
+
+    // writes what's left, waits for the writer, file offset ends up where write() would leave it
+    void finish() {
+        size_t total = 0;
+        if (current) {
+            auto aligned = current->used & ~(align - 1);
+            auto tail = current->used - aligned;
+            auto at = current->at;
+            total = at + current->used;
+            current->last = true;
+            ring.publish();
+            writer.join();
+            if (error)
+                std::rethrow_exception(error);
+            phase_scope scope{st, phase::write};
+            pwrite_all(fd, current->buffer->data + aligned, tail, off_t(at + aligned), st);
+        } else {
+            ring.close();
+            writer.join();
+        }
+        st.add(writer_st);
+        lseek(fd, off_t(total), SEEK_SET);
+    }
+
+private:
+    struct slot {
+        std::unique_ptr<local_buffer> buffer;
+        size_t used = 0;
+        size_t at = 0;      // file offset of buffer, aligned
+        bool last = false;
+    };
+
+    direct_output(int fd, int direct, size_t slot_size, int drop_input, stats &st)
+        : fd(fd), direct(direct), drop_input(drop_input), slot_size(round_up(std::max(slot_size, align))),
+          st(st), writer_st(st.engine, st.enabled), writer([this] { write_slots(); }) {}
+
+    static size_t round_up(size_t n) { return (n + align - 1) & ~(align - 1); }
+
+    // current slot goes to the writer up to its last whole block, the rest starts the next one
+    void next_slot(size_t n) {
+        phase_scope scope{st, phase::write};
+        const char *tail = nullptr;
+        size_t tail_size = 0, at = 0;
+        if (current) {
+            auto aligned = current->used & ~(align - 1);
+            tail = current->buffer->data + aligned;
+            tail_size = current->used - aligned;
+            at = current->at + aligned;
+            ring.publish();     // the writer only reads it, tail stays valid until next publish
+        }
+        current = ring.claim();
+        if (!current) {
+            writer.join();
+            std::rethrow_exception(error);
+        }
+        auto need = round_up(tail_size + n);
+        if (!current->buffer || current->buffer->size < need)
+            current->buffer = std::make_unique<local_buffer>(std::max(slot_size, need));
+        if (tail_size)
+            memcpy(current->buffer->data, tail, tail_size);
+        current->used = tail_size;
+        current->at = at;
+    }
+
+    void write_slots() {
+        if (st.counting())
+            writer_st.enable_perf();
+        try {
+            size_t dropped = 0;
+            while (auto s = ring.front()) {
+                auto aligned = s->used & ~(align - 1);
+                {
+                    phase_scope scope{writer_st, phase::write};
+                    pwrite_all(direct, s->buffer->data, aligned, off_t(s->at), writer_st);
+                }
+                // pages read last may still be held and are skipped, so the range before is dropped again
+                auto written = s->at + aligned;
+                if (drop_input != -1 && written > dropped) {
+                    auto from = dropped > slot_size ? dropped - slot_size : 0;
+                    if (posix_fadvise(drop_input, off_t(from), off_t(written - from), POSIX_FADV_DONTNEED))
+                        drop_input = -1;    // pipe
+                    dropped = written;
+                }
+                auto last = s->last;
+                ring.release();
+                if (last)
+                    return;
+            }
+        } catch (...) {
+            error = std::current_exception();
+            ring.close();
+        }
+    }
+
+    int fd, direct, drop_input;
+    size_t slot_size;
+    stats &st;
+    stats writer_st;
+    spsc_ring<slot> ring{2};
+    slot *current = nullptr;
+    std::exception_ptr error;
+    std::thread writer;
+};
+
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cerrno>
+#include <memory>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "fasta.hpp"
+#include "fused.hpp"
+#include "options.hpp"
+#include "output.hpp"
+#include "stats.hpp"
+#include "record_stats.hpp"
+#include "tuning.hpp"
+
+/*
+  Pieces shared by revcomp engines (engine_memory, engine_pread, engine_stream,
+  engine_pipeline).
+
+  Engine = how input gets into memory. Transform (fasta.hpp) and output coalescing
+  (output.hpp) are the same for all of them. Every engine is a template on complement
+  kernel K (kernels.hpp), revcomp --kernel= picks it at startup, --validate and
+  --stats-per-record wrap it in with_extras<K, X> (record_stats.hpp).
+*/
+
+namespace revcomp {
+
+// read-only mapping of whole file
+class mapping {
+public:
+    mapping(int fd, size_t size, int flags = MAP_PRIVATE | MAP_POPULATE) : size(size) {
+        if (size == 0)
+            return;
+        auto p = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        data = static_cast<const char*>(p);
+    }
+    mapping(const mapping&) = delete;
+    mapping& operator=(const mapping&) = delete;
+    ~mapping() {
+        if (data)
+            munmap(const_cast<char*>(data), size);
+    }
+
+    const char *data = nullptr;
+    size_t size;
+};
+
+// read up to n bytes, 0 means EOF
+static inline size_t read_some(int fd, char *p, size_t n, stats &st, phase ph = phase::read) {
+    while (true) {
+        auto bytes = read(fd, p, n);
+        if (bytes >= 0) {
+            st.syscall(ph, bytes);
+            return bytes;
+        }
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "read");
+    }
+}
+
+// pread exactly n bytes unless EOF comes first
+static inline size_t pread_full(int fd, char *p, size_t n, off_t offset, stats &st,
+                                phase ph = phase::read) {
+    size_t done = 0;
+    while (done < n) {
+        auto bytes = pread(fd, p + done, n - done, offset + done);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "pread");
+        }
+        st.syscall(ph, bytes);
+        if (bytes == 0)
+            break;
+        done += bytes;
+    }
+    return done;
+}
+
+/*
+  Residues transformed per window: whole lines, ~window bytes of output. Lines wider
+  than the window (whole chromosome on one line) are cut, such window may end on a
+  line break of the output, so it needs step + step / width + 1 bytes.
+*/
+static inline size_t window_residues(size_t width, size_t window) {
+    return width >= window ? std::max<size_t>(window, 1) : window / (width + 1) * width;
+}
+
+/*
+  Put body of record r to output, body points to its first residue.
+  Big bodies go in windows so output buffer never grows past its capacity.
+*/
+template <class K>
+static inline void put_body(const char *body, const record &r, output_buffer &out, stats &st,
+                            size_t tile) {
+    auto n = r.residues(), w = r.width;
+    auto step = window_residues(w, tile);
+    for (size_t i = 0; i < n; i += step) {
+        auto i1 = std::min(n, i + step);
+        auto o = out.reserve(step + step / w + 1);
+        auto bytes = revcomp_range<K>(body, 0, n, w, i, i1, o);
+        out.commit(bytes);
+    }
+    st.processed(phase::transform, r.body_size());
+}
+
+/*
+  Records the index found ragged (fasta.hpp) go through the line walk of stream engine,
+  one for all of them, made on first use - most inputs have none.
+*/
+template <class K>
+class ragged_records {
+public:
+    ragged_records(output_buffer &out, stats &st, const tuning &tune) : out(out), st(st), tune(tune) {}
+
+    // record r, its bytes from '>' come to feed() in order, then end()
+    void begin(const record &r) {
+        if (!walk)
+            walk = std::make_unique<fused_records<K>>(out, st, tune.tile, tune.spill_above);
+        out.begin_record(r.next - r.header);
+        walk->begin_record();
+    }
+    void feed(const char *p, size_t n) { walk->feed(p, n); }
+    void end() { walk->finish(); }
+
+    // whole record in memory, data is what record offsets are relative to
+    void put(const char *data, const record &r) {
+        begin(r);
+        feed(data + r.header, r.next - r.header);
+        end();
+    }
+
+private:
+    output_buffer &out;
+    stats &st;
+    const tuning &tune;
+    std::unique_ptr<fused_records<K>> walk;
+};
+
+// whole record which is in memory, data is what record offsets are relative to
+template <class K>
+static inline void put_record(const char *data, const record &r, output_buffer &out, stats &st,
+                              size_t tile) {
+    out.begin_record(r.next - r.header);
+    out.append(data + r.header, r.body - r.header);
+    put_body<K>(data + r.body, r, out, st, tile);
+    record_extras<K> extras{{data + r.header, r.body - r.header}};
+    extras.take(data + r.body, 0, r.width);
+    extras.finish(r.residues());
+    out.append(data + r.end, r.next - r.end);
+    out.end_record({data + r.header, r.body - r.header});
+    st.records++;
+}
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <vector>
+
+#include "engine.hpp"
+#include "parallel.hpp"
+
+/*
+  memory engine - whole input mapped (rev2 lineage).
+
+  rev2 read() everything into anonymous MAP_POPULATE buffer, here pages come straight
+  from page cache so there is no copy and no ~0.2s for faulting big anonymous WS.
+  Index is one memchr pass, then records are transformed with output coalescing.
+  Needs regular file on stdin which fits in RAM.
+
+  With threads > 1 output is cut into ~write_batch jobs at record or line starts and
+  transformed by pinned workers (parallel.hpp). Output offsets == input offsets, so a
+  job is just byte range [a, b) of the file and needs no state from previous jobs.
+  A ragged record (fasta.hpp) moves offsets after it, such input is done by one thread.
+*/
+
+namespace revcomp {
+
+// cut points of [0, size): record headers and line starts, ~job bytes apart
+static inline std::vector<size_t> job_cuts(const std::vector<record> &index, size_t size,
+                                           size_t job) {
+    std::vector<size_t> cuts{0};
+    for (auto &r : index) {
+        if (r.header - cuts.back() >= job)
+            cuts.push_back(r.header);
+        auto line = r.width + 1;
+        while (r.next - cuts.back() > job) {
+            auto base = std::max(cuts.back(), r.body);
+            auto lines = std::max((base + job - r.body) / line, (base - r.body) / line + 1);
+            auto pos = r.body + lines * line;
+            if (pos >= r.end)
+                break;
+            cuts.push_back(pos);
+        }
+    }
+    if (cuts.back() < size)
+        cuts.push_back(size);
+    return cuts;
+}
+
+// output bytes [a, b), both are cut points, counts of kernel extras go to totals[record] (may be null without them)
+template <class K>
+static inline size_t transform_span(const char *data, size_t first, const std::vector<record> &index,
+                                    size_t a, size_t b, char *out, base_counts *totals) {
+    auto copy = [&](size_t x, size_t y) {
+        x = std::max(x, a);
+        y = std::min(y, b);
+        if (x < y)
+            memcpy(out + (x - a), data + x, y - x);
+    };
+    copy(0, first);
+    auto r = std::upper_bound(index.begin(), index.end(), a,
+                              [](size_t pos, const record &r) { return pos < r.next; });
+    for (; r != index.end() && r->header < b; ++r) {
+        copy(r->header, r->body);
+        auto x = std::max(a, r->body), y = std::min(b, r->end);
+        if (x < y) {
+            auto n = r->residues(), w = r->width;
+            auto i0 = (x - r->body) / (w + 1) * w;
+            auto i1 = y == r->end ? n : (y - r->body) / (w + 1) * w;
+            revcomp_range<K>(data + r->body, 0, n, w, i0, i1, out + (x - a));
+            record_extras<K> extras{{data + r->header, r->body - r->header}};
+            extras.take(data + r->body, 0, w);
+            base_counts unused;
+            extras.finish_part(totals ? totals[r - index.begin()] : unused);
+        }
+        copy(r->end, r->next);
+    }
+    return b - a;
+}
+
+template <class K = default_kernel>
+static inline void run_memory(int in, output_buffer &buf, size_t size, const tuning &tune,
+                              stats &st, size_t threads = 1) {
+    std::unique_ptr<mapping> input;
+    {
+        phase_scope scope{st, phase::read};
+        input = std::make_unique<mapping>(in, size);
+        st.processed(phase::read, size);
+    }
+    auto data = input->data;
+    if (!data)
+        return;
+
+    std::vector<record> index;
+    size_t first;
+    bool ragged = false;
+    {
+        phase_scope scope{st, phase::index};
+        auto p = (const char*)memchr(data, '>', size);
+        first = p ? p - data : size;
+        for (auto pos = first; pos < size; pos = index.back().next) {
+            index.push_back(parse_record(data, size, pos));
+            ragged |= index.back().ragged;
+        }
+        st.processed(phase::index, size);
+    }
+
+    phase_scope scope{st, phase::transform};
+    if (threads > 1 && !ragged) {
+        auto cuts = job_cuts(index, size, tune.write_batch);
+        auto jobs = cuts.size() - 1;
+        auto longest = size_t(0), largest = size_t(0);
+        for (size_t j = 0; j < jobs; j++)
+            longest = std::max(longest, cuts[j + 1] - cuts[j]);
+        for (auto &r : index)
+            largest = std::max(largest, r.next - r.header);
+        buf.begin_record(largest);
+        std::vector<base_counts> totals(has_extra(extras_of<K>, count_bases) ? index.size() : 0);
+        auto ending = index.begin();
+        // --perf counts threads apart, worker t (jobs t, t + workers, ...) transforms with its own
+        auto workers = std::min(threads, jobs);
+        std::vector<stats> counted;
+        for (size_t t = 0; st.counting() && t < workers; t++)
+            counted.emplace_back(st.engine);
+        run_ordered(topology::host(), workers, jobs, longest,
+            [&](size_t j, char *o) {
+                if (counted.empty())
+                    return transform_span<K>(data, first, index, cuts[j], cuts[j + 1], o, totals.data());
+                auto &ws = counted[j % workers];
+                if (j < workers)
+                    ws.enable_perf();
+                phase_scope scope{ws, phase::transform};
+                return transform_span<K>(data, first, index, cuts[j], cuts[j + 1], o, totals.data());
+            },
+            [&](size_t j, const char *o, size_t n) {
+                if (!buf.checksumming())
+                    return buf.put(o, n);
+                // checksums need record ends, jobs are cut at lines too
+                auto a = cuts[j], b = a + n;
+                if (a < first && first <= b) {
+                    buf.put(o, first - a);
+                    buf.end_preamble();
+                    o += first - a;
+                    a = first;
+                }
+                for (; ending != index.end() && ending->next <= b; ++ending) {
+                    buf.put(o, ending->next - a);
+                    buf.end_record({data + ending->header, ending->body - ending->header});
+                    o += ending->next - a;
+                    a = ending->next;
+                }
+                buf.put(o, b - a);
+            });
+        buf.flush();
+        for (auto &ws : counted)
+            st.add_counters(ws);
+        if (auto table = record_stats_table())
+            for (size_t i = 0; i < totals.size(); i++)
+                table->row({data + index[i].header, index[i].body - index[i].header}, index[i].residues(),
+                           totals[i]);
+        for (auto &r : index)
+            st.processed(phase::transform, r.body_size());
+        st.records += index.size();
+        return;
+    }
+
+    buf.put(data, first);
+    buf.end_preamble();
+    ragged_records<K> walk{buf, st, tune};
+    for (auto &r : index)
+        r.ragged ? walk.put(data, r) : put_record<K>(data, r, buf, st, tune.tile);
+    buf.flush();
+}
+
+}
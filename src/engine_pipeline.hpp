@@ -0,0 +1,223 @@
+#pragma once
+
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "engine.hpp"
+#include "fused.hpp"
+#include "parallel.hpp"
+
+/*
+  pipeline engine - stream engine split into threads, for pipes.
+
+  stream engine does read(), fused transform and write() one after another, so the
+  cpu is idle while it waits for the pipe and the pipe is idle while it transforms.
+  Here each has own thread and they are connected by spsc_ring (parallel.hpp) of
+  fixed buffers which are reused all the time:
+
+    reader --job--> transform t --chunks--> writer (calling thread)
+
+  Reader fills job buffers of 4 read_chunks and cuts them before the last "\n>" in
+  their second half - such '>' always starts a record, so every job is whole
+  records and transform threads don't depend on each other. What is after the cut
+  is copied to the next job. A job without such cut (record bigger than half a job)
+  continues in the next one, which then goes to the same transform thread, its
+  fused_records keeps staged residues between them.
+
+  Job j goes to ring of thread t, t moves to next thread after every job which
+  ends with a cut. Writer follows the same rule, so reading chunks ring by ring it
+  gets them in input order, no sequence numbers or reorder buffer are needed.
+  Transform threads hand output over in output_buffer chunks (hand_off_to), the last
+  one of each job marks its end.
+
+  Jobs are small so that each stage works in L2: 245MB through a pipe on one cpu
+  takes 0.42s with 4MB jobs, 0.30s with 256KB ones (stream engine 0.23s - on one
+  cpu the threads only take turns, so auto picks pipeline with 3+ cpus).
+
+  --stats-per-record rows are written by transform thread, with it there's just one.
+  --stats time of a phase is summed over threads (busy time), wall_ns is real.
+*/
+
+namespace revcomp {
+
+struct pipeline_job {
+    std::vector<char> data;
+    size_t size = 0;
+    bool cut = false;   // ends with a whole record
+    bool last = false;  // end of input
+    bool stop = false;  // no more jobs for this thread
+};
+
+struct pipeline_chunk {
+    std::vector<char> data;
+    size_t size = 0;
+    std::vector<record_end> ends;
+    bool job_end = false, cut = false, last = false;
+};
+
+// where to cut job of n bytes: after the last '\n' in [n/2, n) which is followed by '>', 0 if none
+static inline size_t job_cut(const char *p, size_t n) {
+    auto lo = std::max<size_t>(n / 2, 1);
+    for (auto e = n; e > lo;) {
+        auto gt = (const char*)memrchr(p + lo, '>', e - lo);
+        if (!gt)
+            break;
+        if (gt[-1] == '\n')
+            return gt - p;
+        e = gt - p;
+    }
+    return 0;
+}
+
+template <class K = default_kernel>
+static inline void run_pipeline(int in, output_buffer &ob, const tuning &tune, stats &st,
+                                size_t threads = 1) {
+    if (has_extra(extras_of<K>, count_bases))
+        threads = 1;
+    auto job_size = std::max<size_t>(tune.read_chunk * 4, 2);
+    std::vector<std::unique_ptr<spsc_ring<pipeline_job>>> jobs;
+    std::vector<std::unique_ptr<spsc_ring<pipeline_chunk>>> chunks;
+    for (size_t t = 0; t < threads; t++) {
+        jobs.push_back(std::make_unique<spsc_ring<pipeline_job>>(2));
+        chunks.push_back(std::make_unique<spsc_ring<pipeline_chunk>>(2));
+    }
+
+    std::mutex failure;
+    std::exception_ptr error;
+    auto fail = [&] {
+        {
+            std::lock_guard lock{failure};
+            if (!error)
+                error = std::current_exception();
+        }
+        for (size_t t = 0; t < threads; t++) {
+            jobs[t]->close();
+            chunks[t]->close();
+        }
+    };
+
+    std::vector<stats> stage;
+    stage.reserve(threads + 1);
+    for (size_t t = 0; t <= threads; t++)
+        stage.emplace_back(st.engine, st.enabled);
+    auto reader = [&] {
+        auto &rs = stage[threads];
+        if (st.counting())
+            rs.enable_perf();
+        phase_scope scope{rs, phase::read};
+        std::vector<char> carry;
+        size_t t = 0;
+        try {
+            for (bool eof = false; !eof;) {
+                auto job = jobs[t]->claim();
+                if (!job)
+                    return;
+                job->data.resize(job_size);
+                std::copy(carry.begin(), carry.end(), job->data.begin());
+                auto size = carry.size();
+                while (size < job_size && !eof) {
+                    auto bytes = read_some(in, job->data.data() + size, job_size - size, rs);
+                    eof = bytes == 0;
+                    size += bytes;
+                }
+                auto cut = eof ? size : job_cut(job->data.data(), size);
+                auto whole = eof || cut;
+                auto end = whole ? cut : size;
+                carry.assign(job->data.data() + end, job->data.data() + size);
+                job->size = end;
+                job->cut = whole;
+                job->last = eof;
+                job->stop = false;
+                jobs[t]->publish();
+                if (whole)
+                    t = (t + 1) % threads;
+            }
+            for (auto &ring : jobs) {
+                auto job = ring->claim();
+                if (!job)
+                    return;
+                job->size = 0;
+                job->stop = true;
+                ring->publish();
+            }
+        } catch (...) {
+            fail();
+        }
+    };
+
+    auto transform = [&](size_t t) {
+        auto &ts = stage[t];
+        if (st.counting())
+            ts.enable_perf();
+        try {
+            bool job_end = false, cut = false, last = false;
+            output_buffer out{-1, ts, job_size};
+            out.hand_off_to([&](std::vector<char> &buf, size_t used, std::vector<record_end> &ends) {
+                auto chunk = chunks[t]->claim();
+                if (!chunk)
+                    throw std::runtime_error("pipeline stopped");
+                std::swap(chunk->data, buf);
+                std::swap(chunk->ends, ends);
+                ends.clear();
+                buf.resize(std::max(buf.size(), chunk->data.size()));
+                chunk->size = used;
+                chunk->job_end = job_end;
+                chunk->cut = cut;
+                chunk->last = last;
+                chunks[t]->publish();
+            }, ob.checksumming());
+            fused_records<K> records{out, ts, tune.tile, tune.spill_above};
+            phase_scope scope{ts, phase::transform};
+            while (auto job = jobs[t]->front()) {
+                if (job->stop)
+                    return;
+                records.feed(job->data.data(), job->size);
+                if (job->cut)
+                    records.finish();
+                cut = job->cut;
+                last = job->last;
+                jobs[t]->release();
+                job_end = true;
+                out.flush();
+                job_end = false;
+            }
+        } catch (...) {
+            fail();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto join = [&] {
+        for (auto &w : workers)
+            w.join();
+    };
+    try {
+        workers.emplace_back(reader);
+        for (size_t t = 0; t < threads; t++)
+            workers.emplace_back(transform, t);
+        for (size_t t = 0;;) {
+            auto chunk = chunks[t]->front();
+            if (!chunk)
+                break;
+            ob.put_chunk(chunk->data.data(), chunk->size, chunk->ends);
+            auto job_end = chunk->job_end, cut = chunk->cut, last = chunk->last;
+            chunks[t]->release();
+            if (job_end && last)
+                break;
+            if (job_end && cut)
+                t = (t + 1) % threads;
+        }
+        ob.flush();
+    } catch (...) {
+        fail();
+    }
+    join();
+    for (auto &s : stage)
+        st.add(s);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+}
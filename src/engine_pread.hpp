@@ -0,0 +1,272 @@
+#pragma once
+
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.hpp"
+#include "parallel.hpp"
+#include "readahead.hpp"
+
+/*
+  pread engine - cpp-7 lineage.
+
+  Index is built with pread over cached index_block blocks, then each record is read
+  backward in read_chunk windows (pread lets us jump over file without big buffer, see main10 in rev3),
+  windows below the one read are queued ahead (readahead.hpp).
+  Records which fit in a batch (write_batch) together are read with one pread.
+  Ragged records (fasta.hpp) go through the line walk of stream engine, big ones
+  forward in batch-sized pieces. Input must be seekable.
+
+  Index is scanned by its own thread at most index_ahead batches ahead of the
+  transform and never kept for the whole file, so memory is index_block + batch +
+  window whatever the input size - a few GB of short reads used to need ~40B of index
+  per record. cpp-7 scans the whole file before it writes the first header, on 100GB
+  that's minutes a consumer of the pipe waits for; here record 1 is transformed as
+  soon as its end is found and the scan of the rest overlaps transform and write
+  (first_byte_ns and wall_ns of --stats). All offsets are 64-bit (revcomp_bench
+  --large checks inputs over 4GB).
+*/
+
+namespace revcomp {
+
+class file_scanner {
+public:
+    file_scanner(int fd, size_t size, size_t block_size, stats &st)
+        : fd(fd), size(size), st(st), mem(block_size) {}
+
+    // first c at or after pos, size if there is none
+    size_t find(char c, size_t pos) {
+        while (pos < size) {
+            load(pos);
+            auto p = (const char*)memchr(mem.data() + (pos - begin), c, bytes - (pos - begin));
+            if (p)
+                return begin + (p - mem.data());
+            pos = begin + bytes;
+        }
+        return size;
+    }
+
+    // same for '>' in a body which starts at pos, lines are checked on the way
+    size_t find_end(size_t pos, line_check &lines) {
+        auto body = pos;
+        while (pos < size) {
+            load(pos);
+            auto k = lines.find_end(mem.data() + (pos - begin), bytes - (pos - begin), pos - body);
+            if (k < bytes - (pos - begin))
+                return pos + k;
+            pos = begin + bytes;
+        }
+        return size;
+    }
+
+    char at(size_t pos) {
+        load(pos);
+        return mem[pos - begin];
+    }
+
+private:
+    void load(size_t pos) {
+        if (pos >= begin && pos < begin + bytes)
+            return;
+        begin = pos;
+        bytes = pread_full(fd, mem.data(), std::min(mem.size(), size - pos), pos, st, phase::index);
+        if (bytes == 0)
+            throw std::runtime_error("input truncated while indexing");
+    }
+
+    int fd;
+    size_t size;
+    stats &st;
+    std::vector<char> mem;
+    size_t begin = 0, bytes = 0;
+};
+
+// records of the file one by one
+class record_cursor {
+public:
+    record_cursor(int fd, size_t size, size_t block_size, stats &st)
+        : scan(fd, size, block_size, st), size(size), start(scan.find('>', 0)), pos(start) {}
+
+    // first '>', text before it is copied as is
+    size_t first() const { return start; }
+
+    // false at EOF
+    bool next(record &r) {
+        if (pos >= size)
+            return false;
+        r.header = pos;
+        r.body = std::min(scan.find('\n', pos) + 1, size);
+        line_check lines;
+        r.next = scan.find_end(r.body, lines);
+        r.end = (r.next > r.body && scan.at(r.next - 1) == '\n') ? r.next - 1 : r.next;
+        r.width = std::max<size_t>(std::min(lines.width(), r.end - r.body), 1);
+        r.ragged = !lines.uniform(r.end - r.body);
+        pos = r.next;
+        return true;
+    }
+
+private:
+    file_scanner scan;
+    size_t size;
+    size_t start;
+    size_t pos;
+};
+
+// record read backward window by window
+template <class K>
+static inline void put_windowed(int fd, const record &r, std::vector<char> &buf, backward_readahead &ahead,
+                                output_buffer &out, stats &st, const tuning &tune) {
+    out.begin_record(r.next - r.header);
+    auto header = out.reserve(r.body - r.header);
+    pread_full(fd, header, r.body - r.header, r.header, st);
+    record_extras<K> extras;
+    extras.add_header(header, r.body - r.header);
+    std::string name{out.checksumming() ? std::string_view{header, r.body - r.header} : ""};
+    out.commit(r.body - r.header);
+
+    auto n = r.residues(), w = r.width;
+    auto step = window_residues(w, tune.read_chunk);
+    buf.resize(std::max(buf.size(), step + step / w + 1));
+    ahead.start(r.body);
+    for (size_t i = 0; i < n; i += step) {
+        auto i1 = std::min(n, i + step);
+        auto [from, to] = source_window(n, w, i, i1);
+        {
+            phase_scope scope{st, phase::read};
+            ahead.read(buf.data(), to - from, r.body + from, st);
+        }
+        auto o = out.reserve(step + step / w + 1);
+        phase_scope scope{st, phase::transform};
+        out.commit(revcomp_range<K>(buf.data(), from, n, w, i, i1, o));
+        extras.take(buf.data(), from, w);
+    }
+    extras.finish(n);
+    st.processed(phase::transform, r.body_size());
+    out.append("\n", r.next - r.end);
+    out.end_record(name);
+    st.records++;
+}
+
+// ragged record bigger than a batch, forward in pieces of buf through the line walk
+template <class K>
+static inline void put_ragged(int fd, const record &r, std::vector<char> &buf, ragged_records<K> &walk, stats &st) {
+    walk.begin(r);
+    for (auto off = r.header; off < r.next;) {
+        size_t bytes;
+        {
+            phase_scope scope{st, phase::read};
+            bytes = pread_full(fd, buf.data(), std::min(buf.size(), r.next - off), off, st);
+        }
+        if (bytes == 0)
+            throw std::runtime_error("input truncated");
+        phase_scope scope{st, phase::transform};
+        walk.feed(buf.data(), bytes);
+        off += bytes;
+    }
+    walk.end();
+}
+
+constexpr size_t index_ahead = 4;
+
+/*
+  Records which fit in a batch (write_batch) together, or one bigger record, pushed
+  to ring by the index thread. Empty batch ends the file.
+*/
+static inline void index_batches(record_cursor &cursor, size_t batch_size, spsc_ring<std::vector<record>> &ring,
+                                 stats &st) {
+    phase_scope scope{st, phase::index};
+    record r;
+    auto more = cursor.next(r);
+    while (true) {
+        auto batch = ring.claim();
+        if (!batch)
+            return;
+        batch->clear();
+        if (more) {
+            auto from = r.header;
+            do {
+                batch->push_back(r);
+                more = cursor.next(r);
+            } while (more && batch->front().next - from <= batch_size && r.next - from <= batch_size);
+        }
+        ring.publish();
+        if (batch->empty())
+            return;
+    }
+}
+
+template <class K = default_kernel>
+static inline void run_pread(int in, output_buffer &ob, size_t size, const tuning &tune, stats &st) {
+    auto batch_size = tune.write_batch;
+
+    stats index_st{st.engine, st.enabled};
+    std::unique_ptr<record_cursor> cursor;
+    {
+        // first block is indexed here, where st counts, the rest on the indexer with index_st
+        phase_scope scope{st, phase::index};
+        cursor = std::make_unique<record_cursor>(in, size, tune.index_block, index_st);
+    }
+    auto first = cursor->first();
+
+    std::vector<char> buf(batch_size);
+    for (size_t off = 0; off < first;) {
+        auto bytes = pread_full(in, buf.data(), std::min(buf.size(), first - off), off, st);
+        ob.put(buf.data(), bytes);
+        off += bytes;
+    }
+    ob.end_preamble();
+
+    backward_readahead ahead{in};
+    ragged_records<K> walk{ob, st, tune};
+    spsc_ring<std::vector<record>> ring{index_ahead};
+    std::exception_ptr index_error;
+    std::thread indexer([&] {
+        if (st.counting())
+            index_st.enable_perf();
+        try {
+            index_batches(*cursor, batch_size, ring, index_st);
+        } catch (...) {
+            index_error = std::current_exception();
+            ring.close();
+        }
+    });
+    try {
+        while (auto batch = ring.front()) {
+            if (batch->empty())
+                break;
+            auto from = batch->front().header;
+            if (batch->back().next - from > batch_size) {
+                if (batch->front().ragged)
+                    put_ragged<K>(in, batch->front(), buf, walk, st);
+                else
+                    put_windowed<K>(in, batch->front(), buf, ahead, ob, st, tune);
+                ring.release();
+                continue;
+            }
+            {
+                phase_scope scope{st, phase::read};
+                pread_full(in, buf.data(), batch->back().next - from, from, st);
+            }
+            phase_scope scope{st, phase::transform};
+            for (auto &b : *batch) {
+                auto r = b.relative_to(from);
+                r.ragged ? walk.put(buf.data(), r) : put_record<K>(buf.data(), r, ob, st, tune.tile);
+            }
+            ring.release();
+        }
+    } catch (...) {
+        ring.close();
+        indexer.join();
+        throw;
+    }
+    indexer.join();
+    if (index_error)
+        std::rethrow_exception(index_error);
+    index_st.processed(phase::index, size);
+    st.add(index_st);
+    ob.flush();
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "engine.hpp"
+#include "fused.hpp"
+
+/*
+  stream engine - for pipes, no seeking (main.cpp / main6 lineage).
+
+  Input is read in read_chunk pieces and each piece goes through fused scan +
+  reverse-complement (fused.hpp) while it's still in L1/L2, so there is no index pass
+  and input bytes are dropped right away. Only staged residues of the current record
+  stay, they grow with mremap (mmap + mremap is ~40ms better than malloc + realloc,
+  see main4), so WS is the biggest record + chunk. With --max-memory staging stops
+  growing at what the budget leaves and bigger records are spilled (memory_budget.hpp).
+*/
+
+namespace revcomp {
+
+template <class K = default_kernel>
+static inline void run_stream(int in, output_buffer &ob, const tuning &tune, stats &st) {
+    std::vector<char> chunk(tune.read_chunk);
+    fused_records<K> records{ob, st, tune.tile, tune.spill_above};
+    while (true) {
+        size_t bytes;
+        {
+            phase_scope scope{st, phase::read};
+            bytes = read_some(in, chunk.data(), chunk.size(), st);
+        }
+        if (bytes == 0)
+            break;
+        phase_scope scope{st, phase::transform};
+        records.feed(chunk.data(), bytes);
+    }
+    phase_scope scope{st, phase::transform};
+    records.finish();
+    ob.flush();
+}
+
+}
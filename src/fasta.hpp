@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <immintrin.h>
+#include <string_view>
+
+#include "kernels.hpp"
+
+/*
+  Record layout shared by all revcomp engines.
+
+    >header\n           [header, body)
+    ACGT...ACGT\n       w residues per line
+    ...
+    ACG                 last line 1..w residues, body ends here (end)
+    \n                  [end, next) - trailing newline if input has it
+
+  Output has exactly the same layout and size, only residues are reverse-complemented,
+  so record offsets in output == offsets in input (cpp-7 relies on it too).
+
+  With w known, residue i sits at body offset i + i/w. That's enough to transform any
+  range of output residues independently - engines use it to work in windows.
+
+  Not every FASTA is like that: lines of different width, blank lines. The index
+  checks lines (line_check) in the same pass which looks for the next '>' and marks
+  such a record ragged; engines give it to the line walk of stream engine
+  (fused_records), which re-wraps residues to the width of the first line. Its
+  output may be shorter or longer than input, offsets after it move.
+*/
+
+namespace revcomp {
+
+struct record {
+    size_t header = 0;  // '>'
+    size_t body = 0;    // first residue
+    size_t end = 0;     // end of residues
+    size_t next = 0;    // next record or end of data
+    size_t width = 0;   // residues per line
+    bool ragged = false;    // lines are not as above, offsets of residues don't apply
+
+    size_t body_size() const { return end - body; }
+    size_t residues() const { return residues_in(body_size(), width); }
+
+    // same record with offsets relative to origin (e.g. start of a batch read)
+    record relative_to(size_t origin) const {
+        return {header - origin, body - origin, end - origin, next - origin, width, ragged};
+    }
+
+    static size_t residues_in(size_t body_size, size_t width) {
+        return body_size - body_size / (width + 1);
+    }
+};
+
+// ">name description\n" -> name
+static inline std::string_view record_name(std::string_view header) {
+    header.remove_prefix(std::min<size_t>(header.size(), 1));
+    return header.substr(0, header.find_first_of(" \t\r\n"));
+}
+
+// body offset of residue i
+static inline size_t residue_offset(size_t i, size_t width) {
+    return i + i / width;
+}
+
+// width = length of first line, single line body has width == body size
+static inline size_t line_width(const char *body, size_t size) {
+    auto nl = (const char*)memchr(body, '\n', size);
+    auto width = nl ? size_t(nl - body) : size;
+    return width ? width : 1;
+}
+
+/*
+  Search for the end of a body (next '>') which also checks its lines: '\n' must be
+  at body offsets w, 2w+1, ... and nowhere else. Both compares are done on the same
+  vector, so it costs about as much as the memchr it replaces (big.fa, 245MB: 32ms,
+  memchr for '>' 34ms; reads are faster as memchr calls per record are fewer). Body comes in pieces
+  (a mapping at once, pread blocks one by one), the first mismatch is remembered
+  and the rest is just memchr. w comes from the first '\n' on the way, the first line
+  isn't scanned on its own (pread read a 100MB single-line record twice for that).
+*/
+class line_check {
+public:
+    // body bytes [at, at + n) are p[0, n): offset of the first '>' in them, n if none
+    size_t find_end(const char *p, size_t n, size_t at) {
+        size_t i = 0;
+        if (!line) {
+            uint64_t m = 0;
+            while (i + block <= n && !(m = mask(p + i, '\n', '>')))
+                i += block;
+            if (m)
+                i += __builtin_ctzll(m);
+            while (!m && i < n && p[i] != '\n' && p[i] != '>')
+                i++;
+            if (i == n || p[i] == '>')
+                return i;
+            start(at + i);
+        }
+        if (broken == ~size_t(0)) {
+            // phase: offset of the next '\n' due from p + i, always < line
+            for (auto phase = expect - at - i; i + block <= n; i += block) {
+                _mm_prefetch(p + i + 2048, _MM_HINT_T0);   // without it 1.5x memchr, with it the same
+                auto want = phase < block ? pattern << phase : 0;
+                phase = phase >= step ? phase - step : phase + line - step;
+                expect = at + i + block + phase;
+                auto seen = mask(p + i, '\n', '>');
+                if (seen == want)
+                    continue;
+                auto gt = mask(p + i, '>', '>'), diff = (seen & ~gt) ^ want;
+                if (gt)
+                    diff &= (gt & -gt) - 1;
+                if (diff)
+                    broken = at + i + __builtin_ctzll(diff);
+                if (gt)
+                    return i + __builtin_ctzll(gt);
+                i += block;
+                break;
+            }
+            for (; i < n && broken == ~size_t(0); i++) {
+                if (p[i] == '>')
+                    return i;
+                auto want = at + i == expect;
+                expect += want ? line : 0;
+                if ((p[i] == '\n') != want)
+                    broken = at + i;
+            }
+        }
+        auto gt = i < n ? (const char*)memchr(p + i, '>', n - i) : nullptr;
+        return gt ? size_t(gt - p) : n;
+    }
+
+    // body [0, size) up to the record's last newline has lines of w but the last, which has 1..w
+    bool uniform(size_t size) const { return !line || (broken >= size && (size % line || size == 0)); }
+
+    // length of the first line, ~0 if no '\n' was found before the end
+    size_t width() const { return first; }
+
+private:
+    static constexpr size_t block = 64;
+
+    // first '\n' at body offset nl, lines are w = nl (1 if it's blank) + '\n'
+    void start(size_t nl) {
+        first = nl;
+        expect = std::max<size_t>(nl, 1);
+        line = expect + 1;
+        step = block % line;
+        for (size_t k = 0; k < block; k += line)
+            pattern |= 1ull << k;
+    }
+
+    // bytes of p[0, block) which are a or b
+    static uint64_t mask(const char *p, char a, char b) {
+        uint64_t m = 0;
+#ifdef __AVX2__
+        for (size_t k = 0; k < block; k += 32) {
+            auto v = _mm256_loadu_si256((const __m256i*)(p + k));
+            auto eq = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(a)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(b)));
+            m |= uint64_t(uint32_t(_mm256_movemask_epi8(eq))) << k;
+        }
+#else
+        for (size_t k = 0; k < block; k += 16) {
+            auto v = _mm_loadu_si128((const __m128i*)(p + k));
+            auto eq = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(a)), _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+            m |= uint64_t(uint16_t(_mm_movemask_epi8(eq))) << k;
+        }
+#endif
+        return m;
+    }
+
+    size_t first = ~size_t(0);      // body offset of the first '\n'
+    size_t line = 0;                // w + 1, 0 - first '\n' not found yet
+    size_t step = 0;                // how the next '\n' due moves against a block
+    size_t expect = 0;              // body offset of the next '\n' due
+    uint64_t pattern = 0;           // '\n's of lines from bit 0 on
+    size_t broken = ~size_t(0);     // first offset where lines are off
+};
+
+// parse record starting at '>' (or any preamble) at pos in data[0, size)
+static inline record parse_record(const char *data, size_t size, size_t pos) {
+    record r;
+    r.header = pos;
+    auto nl = (const char*)memchr(data + pos, '\n', size - pos);
+    r.body = nl ? size_t(nl - data) + 1 : size;
+    line_check lines;
+    r.next = r.body + lines.find_end(data + r.body, size - r.body, 0);
+    r.end = (r.next > r.body && data[r.next - 1] == '\n') ? r.next - 1 : r.next;
+    r.width = std::max<size_t>(std::min(lines.width(), r.end - r.body), 1);
+    r.ragged = !lines.uniform(r.end - r.body);
+    return r;
+}
+
+/*
+  Write reverse-complement residues [i0, i1) of a body with n residues and width w
+  to out (output layout, newlines included). src[k] is input body byte src_off + k,
+  so caller may pass only the window it has read. Returns bytes written.
+
+  Every output line is glued from at most two input line segments, each segment
+  is contiguous in input so kernel K (kernels.hpp) works on runs of up to w bytes.
+*/
+template <class K = default_kernel>
+static inline size_t revcomp_range(const char *src, size_t src_off, size_t n, size_t w,
+                                   size_t i0, size_t i1, char *out) {
+    auto o = out;
+    for (auto i = i0; i < i1;) {
+        auto r = n - 1 - i;
+        auto seg = std::min({w - i % w, r % w + 1, i1 - i});
+        K::reverse_complement(src + (residue_offset(r, w) + 1 - src_off), o, seg);
+        o += seg;
+        i += seg;
+        if (i % w == 0 && i < n)
+            *o++ = '\n';
+    }
+    return o - out;
+}
+
+/*
+  Reverse-complement of input residues [start, end) of a body with width w, without
+  newlines (region of a reference, revcompd). Same line segments as revcomp_range,
+  taken from the last one. Returns end - start.
+*/
+template <class K = default_kernel>
+static inline size_t revcomp_region(const char *body, size_t w, size_t start, size_t end, char *out) {
+    auto o = out;
+    for (auto i = end; i > start;) {
+        auto from = std::max(start, (i - 1) / w * w);
+        K::reverse_complement(body + residue_offset(i - 1, w) + 1, o, i - from);
+        o += i - from;
+        i = from;
+    }
+    return o - out;
+}
+
+// input body bytes which residues [i0, i1) of the output come from
+static inline std::pair<size_t, size_t> source_window(size_t n, size_t w, size_t i0, size_t i1) {
+    return {residue_offset(n - i1, w), residue_offset(n - 1 - i0, w) + 1};
+}
+
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <system_error>
+#include <vector>
+
+#include "kernels.hpp"
+#include "memory_budget.hpp"
+#include "output.hpp"
+#include "record_stats.hpp"
+#include "stats.hpp"
+
+/*
+  Fused delimiter scan + reverse-complement, one pass over each chunk right after read().
+
+  rev2: "every byte is touched 4 times" - read, memchr for '\n' and '>', reverse, write.
+  Here the vector which is compared against '\n' and '>' is also the one which gets
+  complemented, reversed and stored (K::fused_block), so the scan is not a separate
+  pass over memory. Kernels without fused_block scan each line with memchr and
+  transform it while it's in L1.
+  Residues go to staging which grows downward - reverse-complement of residues seen so
+  far is always contiguous at its top - and when '>' (or EOF) ends the record they are
+  re-wrapped to the record's width straight into output buffer.
+
+  Output is the same as with index + revcomp_range (fasta.hpp) for well formed input:
+  width is length of the first body line, trailing newline before next '>' is kept.
+  Other engines send records with ragged lines here, so all give the same bytes.
+  Kernel extras (--validate, --stats-per-record) of a record are reported when it's emitted.
+  With spill_above (--max-memory, memory_budget.hpp) staging stops growing there and a
+  full staging goes to spill file.
+*/
+
+namespace revcomp {
+
+template <class K>
+class fused_records {
+public:
+    // tile - output bytes re-wrapped at once, spill_above - staging limit, 0 = none
+    fused_records(output_buffer &out, stats &st, size_t tile, size_t spill_above = 0)
+        : out(out), st(st), tile(tile), spill_above(spill_above),
+          capacity(std::max<size_t>(spill_above ? std::min(tile, spill_above) : tile, 64)),
+          mem(map(capacity)), top(capacity) {}
+    fused_records(const fused_records&) = delete;
+    fused_records& operator=(const fused_records&) = delete;
+    ~fused_records() { munmap(mem, capacity); }
+
+    // next piece of input
+    void feed(const char *p, size_t n) {
+        auto e = p + n;
+        while (p < e) {
+            if (state == in_preamble) {
+                auto gt = (const char*)memchr(p, '>', e - p);
+                auto stop = gt ? gt : e;
+                out.append(p, stop - p);
+                p = stop;
+                if (gt)
+                    begin_header();
+            } else if (state == in_header) {
+                auto nl = (const char*)memchr(p, '\n', e - p);
+                auto stop = nl ? nl + 1 : e;
+                out.append(p, stop - p);
+                extras.add_header(p, stop - p);
+                if (out.checksumming())
+                    header.append(p, stop - p);
+                p = stop;
+                if (nl)
+                    state = in_body;
+            } else {
+                p = body(p, e);
+            }
+        }
+        st.processed(phase::transform, n);
+    }
+
+    /*
+      Record on its own (index found it ragged, fasta.hpp): its bytes from '>' go to
+      feed() and then finish(), output is what a stream of them would give.
+    */
+    void begin_record() {
+        state = in_header;
+        width = 0;
+        first_line = true;
+        newline_last = false;
+        st.records++;
+    }
+
+    // EOF, last record has no '>' after it; next feed() starts over as new input
+    void finish() {
+        if (state != in_preamble)
+            emit();
+        state = in_preamble;
+    }
+
+private:
+    enum { in_preamble, in_header, in_body };
+
+    void begin_header() {
+        if (state == in_body)
+            emit();
+        else if (state == in_preamble)
+            out.end_preamble();
+        begin_record();
+    }
+
+    // residues up to next delimiter and the delimiter, returns where to continue
+    const char *body(const char *p, const char *e) {
+        auto staged = p, d = p;
+        auto before = spilled + capacity - top;
+        if constexpr (has_fused_block<K>) {
+            for (; d + K::block <= e; d += K::block) {
+                auto mask = K::fused_block(d, stage(K::block));
+                if (mask) {
+                    top += K::block;
+                    d += __builtin_ctzll(mask);
+                    break;
+                }
+                staged = d + K::block;
+            }
+        }
+        if (d == staged) {
+            auto line_end = (const char*)memchr(d, '\n', e - d);
+            auto gt = (const char*)memchr(d, '>', (line_end ? line_end : e) - d);
+            d = gt ? gt : line_end ? line_end : e;
+        }
+        K::reverse_complement(d, stage(d - staged), d - staged);
+        extras.take_run(p, before);
+
+        if (first_line)
+            width += d - p;
+        if (d > p)
+            newline_last = false;
+        if (d == e)
+            return e;
+        if (*d == '\n') {
+            first_line = false;
+            newline_last = true;
+            return d + 1;
+        }
+        begin_header();
+        return d;
+    }
+
+    // n bytes below staged residues, staging grows (and its content moves to new top) if needed
+    char *stage(size_t n) {
+        if (top < n && spill_above && capacity >= spill_above)
+            spill_staged();
+        if (top < n) {
+            auto used = capacity - top;
+            auto new_capacity = std::max(capacity * 2, used + n);
+            if (spill_above)
+                new_capacity = std::max(std::min(new_capacity, spill_above), used + n);
+            auto p = mremap(mem, capacity, new_capacity, MREMAP_MAYMOVE);
+            if (p == MAP_FAILED)
+                throw std::system_error(errno, std::generic_category(), "mremap");
+            mem = static_cast<char*>(p);
+            memmove(mem + new_capacity - used, mem + top, used);
+            top = new_capacity - used;
+            capacity = new_capacity;
+        }
+        top -= n;
+        return mem + top;
+    }
+
+    // staging is full at spill_above: its residues go to spill file and it starts over
+    void spill_staged() {
+        if (!spill)
+            spill = std::make_unique<spill_file>();
+        segments.push_back({spill->append(mem + top, capacity - top), capacity - top});
+        spilled += capacity - top;
+        top = capacity;
+    }
+
+    // staged record body to output in lines of width, spilled parts after it, last one first
+    void emit() {
+        auto n = spilled + capacity - top, w = std::max<size_t>(width, 1);
+        auto i = wrap(mem + top, capacity - top, 0, n, w);
+        for (auto s = segments.rbegin(); s != segments.rend(); ++s) {
+            for (size_t done = 0; done < s->size;) {
+                auto len = std::min(capacity, s->size - done);
+                spill->read(mem, len, s->offset + done);
+                i = wrap(mem, len, i, n, w);
+                done += len;
+            }
+        }
+        if (!segments.empty()) {
+            segments.clear();
+            spilled = 0;
+            spill->clear();
+        }
+        if (newline_last)
+            out.append("\n", 1);
+        out.end_record(header);
+        header.clear();
+        top = capacity;
+        extras.finish(n);
+    }
+
+    // residues src[0, len) are i.. of n output residues, in lines of w, ~tile at once; returns i + len
+    size_t wrap(const char *src, size_t len, size_t i, size_t n, size_t w) {
+        auto column = i % w;
+        for (auto e = i + len; i < e;) {
+            auto m = std::min(e - i, std::max<size_t>(tile, 1));
+            auto o = out.reserve(m + m / w + 1);
+            size_t k = 0;
+            for (auto stop = i + m; i < stop;) {
+                auto seg = std::min(w - column, stop - i);
+                memcpy(o + k, src, seg);
+                src += seg;
+                k += seg;
+                i += seg;
+                column += seg;
+                if (column == w) {
+                    column = 0;
+                    if (i < n)
+                        o[k++] = '\n';
+                }
+            }
+            out.commit(k);
+        }
+        return i;
+    }
+
+    static char *map(size_t size) {
+        auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        return static_cast<char*>(p);
+    }
+
+    output_buffer &out;
+    stats &st;
+    size_t tile;
+    size_t spill_above;
+    size_t capacity;
+    char *mem;
+    size_t top;                 // staging holds [top, capacity)
+    int state = in_preamble;
+    size_t width = 0;           // residues in the first line so far / final width
+    bool first_line = true;
+    bool newline_last = false;  // body ended with '\n' (so far)
+    record_extras<K> extras;
+    std::string header;         // only when output is checksummed
+    struct segment {
+        size_t offset, size;
+    };
+    std::unique_ptr<spill_file> spill;
+    std::vector<segment> segments;  // spilled parts of current record, in input order
+    size_t spilled = 0;             // residues in them
+};
+
+}
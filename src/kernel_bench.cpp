@@ -0,0 +1,186 @@
+/*
+  kernel_bench - complement kernels alone, cycles per byte by working set.
+
+  usage: kernel_bench [repeats=3]
+
+  revcomp_bench measures engines end to end, where a slower kernel hides behind read,
+  index and write. Here reverse-complement of src into dst runs with working set (both
+  buffers) of half of L1d, half of L2, half of L3 and 4x L3 (DRAM) of the host, every
+  point is best of repeats passes over >= 64MB. Rows besides kernels.hpp:
+
+    memcpy        copy, the floor at that size
+    reverse       std::reverse_copy, no complement - rev4 says GCC vectorizes it at ~4B/cycle
+    simd_reverse  simd_reverse.hpp in place in dst, what clang builds get instead
+    swmap         cpp-7 switch per byte
+    map256        cpp-7 1B table
+    map           cpp-7 2B table (complement.hpp reverse_complement)
+    K+valid       kernel K with check_alphabet, vector_in_set of rev4 on the same registers
+
+  Cycles are core cycles of perf_counters.hpp when there is a PMU, rdtsc otherwise
+  (TSC ticks at nominal frequency, so under turbo it shows fewer than real cycles) -
+  the header says which. Output of every row is checked against map256.
+
+  llvm-mca: `make -C bin/release mca` writes kernel_bench.s compiled with
+  -DKERNEL_BENCH_MCA, which adds one step of every kernel (one vector, 16 bytes for
+  scalar ones) between LLVM-MCA-BEGIN/END markers:
+
+    llvm-mca -mcpu=native -iterations=1000 kernel_bench.s
+
+  gives the steady state of each inner loop. Regions of branchy kernels (swar64) have
+  both paths in them, mca doesn't follow branches.
+
+  1 vCPU VM without PMU (rdtsc), mixed residues: avx512 0.12 per byte in L1 and 0.5 at
+  L3/DRAM, ssse3 0.55 and avx2 0.63 in L1 - their mca regions show why, active_table()
+  guard and the tables are loaded again for every vector, stores through char* may
+  alias the table.
+*/
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+
+#include "calibrate.hpp"
+#include "kernels.hpp"
+#include "perf_counters.hpp"
+
+namespace revcomp {
+
+#ifdef KERNEL_BENCH_MCA
+#define MCA_REGION(K, BYTES)                                                \
+    [[gnu::used, gnu::noinline]] void mca_##K(const char *src, char *dst) { \
+        asm volatile("# LLVM-MCA-BEGIN " #K ::: "memory");                  \
+        K::reverse_complement(src + BYTES, dst, BYTES);                     \
+        asm volatile("# LLVM-MCA-END " #K ::: "memory");                    \
+    }
+MCA_REGION(lut8, 16)
+MCA_REGION(lut16, 16)
+MCA_REGION(swar64, 16)
+#ifdef __SSSE3__
+MCA_REGION(ssse3, 16)
+#endif
+#ifdef __AVX2__
+MCA_REGION(avx2, 32)
+#endif
+#if defined(__AVX512BW__) && defined(__AVX512VBMI__)
+MCA_REGION(avx512, 64)
+#endif
+#endif
+
+// core cycles if PMU is there, TSC ticks otherwise
+class cycle_clock {
+public:
+    uint64_t now() const { return pmu.available(0) ? uint64_t(pmu.read()[0]) : __rdtsc(); }
+    const char *unit() const { return pmu.available(0) ? "core cycles" : "rdtsc"; }
+
+private:
+    perf_counters pmu;
+};
+
+using row_fn = std::function<void(const char *src_end, char *dst, size_t n)>;
+
+static std::vector<std::pair<std::string, row_fn>> rows() {
+    std::vector<std::pair<std::string, row_fn>> r;
+    r.emplace_back("memcpy", [](const char *src_end, char *dst, size_t n) { memcpy(dst, src_end - n, n); });
+    r.emplace_back("reverse", [](const char *src_end, char *dst, size_t n) {
+        std::reverse_copy(src_end - n, src_end, dst);
+    });
+    r.emplace_back("simd_reverse", [](const char *, char *dst, size_t n) { simd_reverse(dst, dst + n); });
+    r.emplace_back("swmap", [](const char *src_end, char *dst, size_t n) {
+        for (; n; n--)
+            *dst++ = char(swmap(uint8_t(*--src_end)));
+    });
+    r.emplace_back("map256", [](const char *src_end, char *dst, size_t n) {
+        for (; n; n--)
+            *dst++ = char(map256[uint8_t(*--src_end)]);
+    });
+    r.emplace_back("map", [](const char *src_end, char *dst, size_t n) { reverse_complement(src_end, dst, n); });
+    for_each_kernel([&]<class K>() {
+        r.emplace_back(K::name, [](const char *src_end, char *dst, size_t n) {
+            K::reverse_complement(src_end, dst, n);
+        });
+    });
+    for_each_kernel([&]<class K>() {
+        r.emplace_back(std::string(K::name) + "+valid", [](const char *src_end, char *dst, size_t n) {
+            if (!K::template reverse_complement<check_alphabet>(src_end, dst, n))
+                throw std::runtime_error("valid input reported invalid");
+        });
+    });
+    return r;
+}
+
+static int bench(int repeats) {
+    auto caches = host_caches();
+    struct level {
+        const char *name;
+        size_t working_set;
+    } levels[] = {{"L1", caches.l1d / 2}, {"L2", caches.l2 / 2}, {"L3", caches.l3 / 2},
+                  {"DRAM", std::max<size_t>(caches.l3 * 4, 256 << 20)}};
+    constexpr size_t min_bytes = 64 << 20;
+    struct input {
+        const char *name;
+        const char *alphabet;
+    } inputs[] = {{"ACGT", "ACGT"}, {"mixed", "ACGTACGTacgtacgtNNRYKMSW"}};
+    cycle_clock clock;
+    auto all = rows();
+
+    for (auto &in : inputs) {
+        // residues only, kernels get runs without newlines
+        auto big = levels[3].working_set / 2;
+        std::string residues;
+        {
+            auto fasta = synthetic_fasta(big + (big >> 4), in.alphabet);
+            residues.reserve(fasta.size());
+            for (size_t pos = 0, eol; pos < fasta.size(); pos = eol + 1) {
+                eol = fasta.find('\n', pos);
+                if (fasta[pos] != '>')
+                    residues.append(fasta, pos, eol - pos);
+            }
+            residues.resize(big);
+        }
+        std::vector<char> dst(big);
+
+        printf("\n%s residues, %s per byte (best of %d)\n%-14s", in.name, clock.unit(), repeats, "");
+        for (auto &l : levels)
+            printf("%6s %-6s", l.name, (std::to_string(l.working_set >> 10) + "K").c_str());
+        printf("\n");
+        for (auto &[name, run] : all) {
+            printf("%-14s", name.c_str());
+            for (auto &l : levels) {
+                auto n = l.working_set / 2;
+                auto src_end = residues.data() + n;
+                auto passes = std::max<size_t>(min_bytes / n, 1);
+                run(src_end, dst.data(), n);    // warm up: page faults, caches
+                auto best = ~uint64_t(0);
+                for (int i = 0; i < repeats; i++) {
+                    auto t0 = clock.now();
+                    for (size_t p = 0; p < passes; p++) {
+                        run(src_end, dst.data(), n);
+                        asm volatile("" ::: "memory");
+                    }
+                    best = std::min(best, clock.now() - t0);
+                }
+                auto same = name == "memcpy" || name == "reverse" || name == "simd_reverse" ||
+                            std::equal(dst.begin(), dst.begin() + n, std::make_reverse_iterator(src_end),
+                                       [](char d, char s) { return d == char(map256[uint8_t(s)]); });
+                printf("%13.3f%s", double(best) / double(passes * n), same ? "" : " DIFF");
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+    try {
+        return revcomp::bench(argc > 1 ? std::stoi(argv[1]) : 3);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "kernel_bench: %s\n", e.what());
+        return 1;
+    }
+}
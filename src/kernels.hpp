@@ -0,0 +1,590 @@
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "complement.hpp"
+#include "simd_reverse.hpp"
+
+/*
+  Complement kernels - policies every revcomp engine is templated on.
+
+  A kernel is a type with
+    name                                      - for --kernel= and the bench
+    reverse_complement(src_end, dst, n)       - same contract as complement.hpp: n bytes
+                                                ending at src_end, backward, to dst
+  and optionally, for fused scan (fused.hpp),
+    block                                     - bytes per step
+    fused_block(p, dst) -> mask               - bit i set if p[i] is '\n' or '>', dst gets
+                                                reverse-complement of p[0, block) anyway
+
+  Both take template flags X (extras, default none and then they compile to nothing -
+  plain kernels run as fast as before extras were added, record_stats.hpp has numbers),
+  computed on the registers which are being complemented:
+    check_alphabet  reverse_complement returns false if some byte is not in the
+                    alphabet (complement_table::valid), fused_block sets masks->invalid
+    count_bases     G/C, N and lowercase bytes added to *counts / set in masks
+  Engines don't call them with X directly, with_extras<K, X> below is a kernel which
+  does and collects results per thread (validate.hpp, record_stats.hpp).
+
+    lut8    map256, byte by byte (cpp-7 tail, main.cpp)
+    lut16   2B map, 128KB table (cpp-7)
+    swar64  8B words: bswap + arithmetic complement when word is all ACGT, lut16 otherwise
+    ssse3   16B, nibble-split pshufb tables (rev4 reverse_complement_sse)
+    avx2    32B, same tables in both lanes, ssse3 for the tail
+    avx512  64B, one vpermb over 64 entry table (needs AVX512-VBMI)
+
+  SIMD kernels exist only if the compiler targets their ISA (-march=native in
+  Makefiles), kernel_names() lists what is built. revcomp_bench measures every
+  engine x kernel pair.
+*/
+
+namespace revcomp {
+
+/*
+  Complement in the forms kernels want. SIMD kernels rely on table layout: bytes
+  0x40..0x7f (letters) have own entries, every other byte maps to `other`.
+
+  Alphabet (bytes with own mapping) is kept as byte set of vector_in_set in rev4:
+  row per low nibble, bit per high nibble. Only letters can be in it, so high nibble
+  is 4..7 and one byte per row is enough.
+*/
+struct complement_table {
+    std::array<uint8_t, 256> byte{};
+    std::array<uint16_t, 1 << 16> pair{};   // 2 bytes at once, swapped
+    alignas(64) std::array<uint8_t, 64> letters{};  // byte 0x40 + i
+    uint8_t other = '_';
+    std::array<bool, 256> valid{};
+    alignas(16) std::array<uint8_t, 16> valid_rows{};       // bit h: byte h << 4 | row
+    alignas(64) std::array<uint8_t, 64> valid_letters{};    // 0xff if 0x40 + i is valid
+
+    // valid(c) - c is in the alphabet, default is every letter which doesn't map to `other`
+    template <class Map>
+    static complement_table from(Map map) {
+        return from(map, [&](uint8_t c) { return map(c) != map(0); });
+    }
+
+    template <class Map, class Valid>
+    static complement_table from(Map map, Valid valid) {
+        complement_table t;
+        for (size_t c = 0; c < 256; c++)
+            t.byte[c] = map(uint8_t(c));
+        for (size_t v = 0; v < t.pair.size(); v++)
+            t.pair[v] = uint16_t(t.byte[v & 0xff] << 8 | t.byte[v >> 8]);
+        for (size_t i = 0; i < 64; i++)
+            t.letters[i] = t.byte[0x40 + i];
+        t.other = t.byte[0];
+        for (size_t c = 0x40; c < 0x80; c++) {
+            t.valid[c] = valid(uint8_t(c));
+            t.valid_rows[c & 0x0f] |= uint8_t(t.valid[c]) << (c >> 4);
+            t.valid_letters[c - 0x40] = t.valid[c] ? 0xff : 0;
+        }
+        return t;
+    }
+};
+
+// tables kernels use
+static inline complement_table &active_table() {
+    static complement_table table = complement_table::from(swmap);
+    return table;
+}
+
+// what kernels do besides the complement - template flags X of reverse_complement and fused_block
+enum : unsigned { check_alphabet = 1, count_bases = 2 };
+
+constexpr bool has_extra(unsigned x, unsigned extra) { return (x & extra) != 0; }
+
+// residue classes for --stats-per-record, counted on input so they don't depend on alphabet
+struct base_counts {
+    uint64_t gc = 0;        // G C g c
+    uint64_t n = 0;         // N n
+    uint64_t lower = 0;     // a..z, soft-masked
+
+    base_counts &operator+=(const base_counts &o) {
+        gc += o.gc, n += o.n, lower += o.lower;
+        return *this;
+    }
+};
+
+// fused_block's input bytes by class, bit i is p[i]
+struct block_masks {
+    uint64_t invalid = 0, gc = 0, n = 0, lower = 0;
+};
+
+// bit 0 G/C, bit 1 N, bit 2 lowercase
+constexpr auto base_classes = [] {
+    std::array<uint8_t, 256> t{};
+    for (size_t c = 0; c < 256; c++) {
+        auto folded = c | 0x20;
+        t[c] = (folded == 'c' || folded == 'g') | (folded == 'n') << 1 | (c >= 'a' && c <= 'z') << 2;
+    }
+    return t;
+}();
+
+// extras X of scalar kernels, one byte at a time
+template <unsigned X>
+struct scalar_extras {
+    bool ok = true;
+    base_counts counts;
+
+    void add(const complement_table &t, uint8_t c) {
+        if constexpr (has_extra(X, check_alphabet))
+            ok &= t.valid[c];
+        if constexpr (has_extra(X, count_bases)) {
+            auto k = base_classes[c];
+            counts.gc += k & 1;
+            counts.n += k >> 1 & 1;
+            counts.lower += k >> 2;
+        }
+    }
+
+    bool finish(base_counts *total) {
+        if constexpr (has_extra(X, count_bases))
+            *total += counts;
+        return ok;
+    }
+};
+
+struct lut8 {
+    static constexpr const char *name = "lut8";
+
+    template <unsigned X = 0>
+    static bool reverse_complement(const char *src_end, char *dst, size_t n, base_counts *counts = nullptr) {
+        auto &t = active_table();
+        scalar_extras<X> x;
+        for (; n; n--) {
+            auto c = uint8_t(*--src_end);
+            *dst++ = t.byte[c];
+            x.add(t, c);
+        }
+        return x.finish(counts);
+    }
+};
+
+struct lut16 {
+    static constexpr const char *name = "lut16";
+
+    template <unsigned X = 0>
+    static bool reverse_complement(const char *src_end, char *dst, size_t n, base_counts *counts = nullptr) {
+        auto &t = active_table();
+        scalar_extras<X> x;
+        for (; n >= 2; n -= 2, dst += 2) {
+            uint16_t v;
+            memcpy(&v, src_end -= 2, 2);
+            memcpy(dst, &t.pair[v], 2);
+            x.add(t, v & 0xff);
+            x.add(t, v >> 8);
+        }
+        auto tail = !n || lut8::reverse_complement<X>(src_end, dst, n, counts);
+        return x.finish(counts) && tail;
+    }
+};
+
+/*
+  A<->T is xor 0x15, C<->G is xor 0x04, bit 1 tells which pair a base is from.
+  Word takes this path only if all 8 bytes are one of "ACGT" and active table agrees
+  with swmap on them.
+*/
+struct swar64 {
+    static constexpr const char *name = "swar64";
+
+    // ACGT words need no check when all four are in the alphabet, and have no N or lowercase
+    template <unsigned X = 0>
+    static bool reverse_complement(const char *src_end, char *dst, size_t n, base_counts *counts = nullptr) {
+        auto &t = active_table();
+        auto arithmetic = t.byte['A'] == 'T' && t.byte['T'] == 'A' && t.byte['C'] == 'G' &&
+                          t.byte['G'] == 'C';
+        if (has_extra(X, check_alphabet))
+            arithmetic &= t.valid['A'] && t.valid['C'] && t.valid['G'] && t.valid['T'];
+        scalar_extras<X> x;
+        for (; n >= 8; n -= 8, dst += 8) {
+            uint64_t v;
+            memcpy(&v, src_end -= 8, 8);
+            v = reversed(v);
+            if (arithmetic && all_acgt(v)) {
+                auto cg = (v >> 1) & ones;
+                v ^= (ones * 0x15) ^ (cg << 4 | cg);
+                memcpy(dst, &v, 8);
+                if constexpr (has_extra(X, count_bases))
+                    x.counts.gc += __builtin_popcountll(cg);
+            } else {
+                for (int i = 0; i < 8; i++) {
+                    auto c = uint8_t(v >> (8 * i));
+                    dst[i] = t.byte[c];
+                    x.add(t, c);
+                }
+            }
+        }
+        auto tail = lut16::reverse_complement<X>(src_end, dst, n, counts);
+        return x.finish(counts) && tail;
+    }
+
+private:
+    static constexpr uint64_t ones = 0x0101010101010101ull;
+    static constexpr uint64_t high = 0x8080808080808080ull;
+
+    // 0x80 in every byte of v which equals c
+    static uint64_t equal(uint64_t v, uint8_t c) {
+        auto x = v ^ (ones * c);
+        return ~(((x & ~high) + ~high) | x | ~high);
+    }
+    static bool all_acgt(uint64_t v) {
+        return (equal(v, 'A') | equal(v, 'C') | equal(v, 'G') | equal(v, 'T')) == high;
+    }
+};
+
+#ifdef __SSSE3__
+struct ssse3 {
+    static constexpr const char *name = "ssse3";
+    static constexpr size_t lanes = 16;
+
+    // select b where mask, a elsewhere (no pblendvb before SSE4.1)
+    static __m128i select(__m128i mask, __m128i a, __m128i b) {
+        return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a));
+    }
+
+    // reverse_complement_sse from rev4 with 4 tables, so lowercase and any letter mapping work
+    static __m128i complement(__m128i v) {
+        auto &t = active_table();
+        auto idx = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+        __m128i q[4];
+        for (int i = 0; i < 4; i++)
+            q[i] = _mm_shuffle_epi8(_mm_load_si128((const __m128i*)&t.letters[16 * i]), idx);
+        auto bit4 = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(0x10)), _mm_set1_epi8(0x10));
+        auto bit5 = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8(0x20));
+        auto c = select(bit5, select(bit4, q[0], q[1]), select(bit4, q[2], q[3]));
+        auto letter = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xc0))), _mm_set1_epi8(0x40));
+        return select(letter, _mm_set1_epi8(char(t.other)), c);
+    }
+
+    // 0xff in bytes outside the alphabet - vector_in_set: row by low nibble, bit by high
+    static __m128i invalid(__m128i v) {
+        auto rows = _mm_load_si128((const __m128i*)active_table().valid_rows.data());
+        auto bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, char(128), 0, 0, 0, 0, 0, 0, 0, 0);
+        auto row = _mm_shuffle_epi8(rows, _mm_and_si128(v, _mm_set1_epi8(0x0f)));
+        auto bit = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f)));
+        return _mm_cmpeq_epi8(_mm_and_si128(row, bit), _mm_setzero_si128());
+    }
+
+    /*
+      compare + popcount of movemask (the sse-popcount TODO in rev4). C G c g differ only
+      in bits 2 and 5, so one compare of v | 0x24 finds all four.
+    */
+    static void count(__m128i v, base_counts &c) {
+        auto gc = _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(0x24)), _mm_set1_epi8('g'));
+        auto n = _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('n'));
+        auto from_a = _mm_sub_epi8(v, _mm_set1_epi8('a'));
+        auto lower = _mm_cmpeq_epi8(_mm_min_epu8(from_a, _mm_set1_epi8(25)), from_a);
+        c.gc += __builtin_popcount(_mm_movemask_epi8(gc));
+        c.n += __builtin_popcount(_mm_movemask_epi8(n));
+        c.lower += __builtin_popcount(_mm_movemask_epi8(lower));
+    }
+
+    template <unsigned X = 0>
+    static bool reverse_complement(const char *src_end, char *dst, size_t n, base_counts *counts = nullptr) {
+        auto bad = _mm_setzero_si128();
+        base_counts c;
+        for (; n >= lanes; n -= lanes, dst += lanes) {
+            auto v = _mm_loadu_si128((const __m128i*)(src_end -= lanes));
+            _mm_storeu_si128((__m128i*)dst, reversed(complement(v)));
+            if constexpr (has_extra(X, check_alphabet))
+                bad = _mm_or_si128(bad, invalid(v));
+            if constexpr (has_extra(X, count_bases))
+                count(v, c);
+        }
+        if constexpr (has_extra(X, count_bases))
+            *counts += c;
+        return lut16::reverse_complement<X>(src_end, dst, n, counts) && !_mm_movemask_epi8(bad);
+    }
+};
+#endif
+
+#ifdef __AVX2__
+struct avx2 {
+    static constexpr const char *name = "avx2";
+    static constexpr size_t block = 32;
+
+    static __m256i table(int i) {
+        return _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)&active_table().letters[16 * i]));
+    }
+
+    static __m256i reverse_complement32(__m256i v) {
+        auto idx = _mm256_and_si256(v, _mm256_set1_epi8(0x0f));
+        auto bit4 = _mm256_slli_epi16(v, 3);   // bit 4 -> sign bit for blendv
+        auto bit5 = _mm256_slli_epi16(v, 2);
+        auto lo = _mm256_blendv_epi8(_mm256_shuffle_epi8(table(0), idx), _mm256_shuffle_epi8(table(1), idx), bit4);
+        auto hi = _mm256_blendv_epi8(_mm256_shuffle_epi8(table(2), idx), _mm256_shuffle_epi8(table(3), idx), bit4);
+        auto c = _mm256_blendv_epi8(lo, hi, bit5);
+        auto letter = _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xc0))),
+                                        _mm256_set1_epi8(0x40));
+        return reversed(_mm256_blendv_epi8(_mm256_set1_epi8(char(active_table().other)), c, letter));
+    }
+
+    // ssse3::invalid in both lanes
+    static __m256i invalid(__m256i v) {
+        auto rows = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)active_table().valid_rows.data()));
+        auto bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, char(128), 0, 0, 0, 0, 0, 0, 0, 0,
+                                     1, 2, 4, 8, 16, 32, 64, char(128), 0, 0, 0, 0, 0, 0, 0, 0);
+        auto row = _mm256_shuffle_epi8(rows, _mm256_and_si256(v, _mm256_set1_epi8(0x0f)));
+        auto bit = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0f)));
+        return _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256());
+    }
+
+    // ssse3::count, masks in input order so fused_block can return them too
+    static block_masks classes(__m256i v) {
+        auto gc = _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x24)), _mm256_set1_epi8('g'));
+        auto n = _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('n'));
+        auto from_a = _mm256_sub_epi8(v, _mm256_set1_epi8('a'));
+        auto lower = _mm256_cmpeq_epi8(_mm256_min_epu8(from_a, _mm256_set1_epi8(25)), from_a);
+        return {0, unsigned(_mm256_movemask_epi8(gc)), unsigned(_mm256_movemask_epi8(n)),
+                unsigned(_mm256_movemask_epi8(lower))};
+    }
+
+    static void count(__m256i v, base_counts &c) {
+        auto m = classes(v);
+        c.gc += __builtin_popcountll(m.gc);
+        c.n += __builtin_popcountll(m.n);
+        c.lower += __builtin_popcountll(m.lower);
+    }
+
+    template <unsigned X = 0>
+    static bool reverse_complement(const char *src_end, char *dst, size_t n, base_counts *counts = nullptr) {
+        auto bad = _mm256_setzero_si256();
+        base_counts c;
+        for (; n >= block; n -= block, dst += block) {
+            auto v = _mm256_loadu_si256((const __m256i*)(src_end -= block));
+            _mm256_storeu_si256((__m256i*)dst, reverse_complement32(v));
+            if constexpr (has_extra(X, check_alphabet))
+                bad = _mm256_or_si256(bad, invalid(v));
+            if constexpr (has_extra(X, count_bases))
+                count(v, c);
+        }
+        if constexpr (has_extra(X, count_bases))
+            *counts += c;
+        return ssse3::reverse_complement<X>(src_end, dst, n, counts) && _mm256_testz_si256(bad, bad);
+    }
+
+    template <unsigned X = 0>
+    static uint64_t fused_block(const char *p, char *dst, block_masks *masks = nullptr) {
+        auto v = _mm256_loadu_si256((const __m256i*)p);
+        _mm256_storeu_si256((__m256i*)dst, reverse_complement32(v));
+        auto delimiters = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+                                          _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+        if constexpr (has_extra(X, count_bases))
+            *masks = classes(v);
+        if constexpr (has_extra(X, check_alphabet))
+            masks->invalid = unsigned(_mm256_movemask_epi8(invalid(v)));
+        return unsigned(_mm256_movemask_epi8(delimiters));
+    }
+};
+#endif
+
+#if defined(__AVX512BW__) && defined(__AVX512VBMI__)
+struct avx512 {
+    static constexpr const char *name = "avx512";
+    static constexpr size_t block = 64;
+
+    // vpermb looks at low 6 bits only, which is exactly letters[c - 0x40] for 0x40..0x7f
+    static __m512i reverse_complement64(__m512i v) {
+        auto &t = active_table();
+        auto all = _cvtu64_mask64(~0ull);  // maskz form, plain vpermb intrinsic trips -Wmaybe-uninitialized in gcc 12
+        auto c = _mm512_maskz_permutexvar_epi8(all, v, _mm512_load_si512(t.letters.data()));
+        auto letter = _mm512_cmpeq_epi8_mask(_mm512_and_si512(v, _mm512_set1_epi8(char(0xc0))),
+                                             _mm512_set1_epi8(0x40));
+        return reversed(_mm512_mask_blend_epi8(letter, _mm512_set1_epi8(char(t.other)), c));
+    }
+
+    // bytes outside the alphabet - the set is 64 letters, so one vpermb over valid_letters
+    static uint64_t invalid(__m512i v) {
+        auto all = _cvtu64_mask64(~0ull);
+        auto in = _mm512_maskz_permutexvar_epi8(all, v, _mm512_load_si512(active_table().valid_letters.data()));
+        auto letter = _mm512_cmpeq_epi8_mask(_mm512_and_si512(v, _mm512_set1_epi8(char(0xc0))),
+                                             _mm512_set1_epi8(0x40));
+        return ~_cvtmask64_u64(_mm512_mask_test_epi8_mask(letter, in, in));
+    }
+
+    // ssse3::count with compares into mask registers
+    static block_masks classes(__m512i v) {
+        auto gc = _mm512_cmpeq_epi8_mask(_mm512_or_si512(v, _mm512_set1_epi8(0x24)), _mm512_set1_epi8('g'));
+        auto n = _mm512_cmpeq_epi8_mask(_mm512_or_si512(v, _mm512_set1_epi8(0x20)), _mm512_set1_epi8('n'));
+        auto lower = _mm512_cmplt_epu8_mask(_mm512_sub_epi8(v, _mm512_set1_epi8('a')), _mm512_set1_epi8(26));
+        return {0, _cvtmask64_u64(gc), _cvtmask64_u64(n), _cvtmask64_u64(lower)};
+    }
+
+    static void count(__m512i v, base_counts &c) {
+        auto m = classes(v);
+        c.gc += __builtin_popcountll(m.gc);
+        c.n += __builtin_popcountll(m.n);
+        c.lower += __builtin_popcountll(m.lower);
+    }
+
+    // masked-off bytes of the tail load are 0, which is in no class
+    template <unsigned X = 0>
+    static bool reverse_complement(const char *src_end, char *dst, size_t n, base_counts *counts = nullptr) {
+        uint64_t bad = 0;
+        base_counts c;
+        for (; n >= block; n -= block, dst += block) {
+            auto v = _mm512_loadu_si512(src_end -= block);
+            _mm512_storeu_si512(dst, reverse_complement64(v));
+            if constexpr (has_extra(X, check_alphabet))
+                bad |= invalid(v);
+            if constexpr (has_extra(X, count_bases))
+                count(v, c);
+        }
+        if (n) {
+            auto load = ~0ull << (block - n);
+            auto keep = _cvtu64_mask64((1ull << n) - 1);
+            auto v = _mm512_maskz_loadu_epi8(_cvtu64_mask64(load), src_end - block);
+            _mm512_mask_storeu_epi8(dst, keep, reverse_complement64(v));
+            if constexpr (has_extra(X, check_alphabet))
+                bad |= invalid(v) & load;
+            if constexpr (has_extra(X, count_bases))
+                count(v, c);
+        }
+        if constexpr (has_extra(X, count_bases))
+            *counts += c;
+        return !bad;
+    }
+
+    template <unsigned X = 0>
+    static uint64_t fused_block(const char *p, char *dst, block_masks *masks = nullptr) {
+        auto v = _mm512_loadu_si512(p);
+        _mm512_storeu_si512(dst, reverse_complement64(v));
+        auto delimiters = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n')) |
+                          _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('>'));
+        if constexpr (has_extra(X, count_bases))
+            *masks = classes(v);
+        if constexpr (has_extra(X, check_alphabet))
+            masks->invalid = invalid(v);
+        return delimiters;
+    }
+};
+#endif
+
+#if defined(__AVX512BW__) && defined(__AVX512VBMI__)
+using default_kernel = avx512;
+#elif defined(__AVX2__)
+using default_kernel = avx2;
+#elif defined(__SSSE3__)
+using default_kernel = ssse3;
+#else
+using default_kernel = lut16;
+#endif
+
+template <class K>
+concept has_fused_block = requires(const char *p, char *dst) {
+    { K::block } -> std::convertible_to<size_t>;
+    { K::fused_block(p, dst) } -> std::convertible_to<uint64_t>;
+};
+
+// what with_extras kernels noted on this thread, engines take it per record
+struct kernel_notes {
+    const char *invalid = nullptr;  // lowest address of a byte outside the alphabet
+    base_counts counts;
+};
+
+static inline kernel_notes &noted() {
+    thread_local kernel_notes notes;
+    return notes;
+}
+
+// first byte of p[0, n) outside the alphabet, if there is one
+static inline void note_invalid(const char *p, size_t n) {
+    auto &valid = active_table().valid;
+    auto e = p + n;
+    for (; p < e && valid[uint8_t(*p)]; p++) {}
+    auto &invalid = noted().invalid;
+    if (p < e && (!invalid || p < invalid))
+        invalid = p;
+}
+
+// kernel K running extras X, results go to noted()
+template <class K, unsigned X>
+struct extras_kernel {
+    static constexpr const char *name = K::name;
+
+    static void reverse_complement(const char *src_end, char *dst, size_t n) {
+        if (!K::template reverse_complement<X>(src_end, dst, n, &noted().counts))
+            note_invalid(src_end - n, n);
+    }
+};
+
+template <class K, unsigned X>
+struct with_extras : extras_kernel<K, X> {};
+
+template <class K, unsigned X>
+    requires has_fused_block<K>
+struct with_extras<K, X> : extras_kernel<K, X> {
+    static constexpr size_t block = K::block;
+
+    // fused.hpp passes residues before a delimiter through reverse_complement again,
+    // so only blocks without one are taken here
+    static uint64_t fused_block(const char *p, char *dst) {
+        block_masks m;
+        auto delimiters = K::template fused_block<X>(p, dst, &m);
+        if (delimiters)
+            return delimiters;
+        if (m.invalid)
+            note_invalid(p + __builtin_ctzll(m.invalid), 1);
+        if constexpr (has_extra(X, count_bases)) {
+            auto &c = noted().counts;
+            c.gc += __builtin_popcountll(m.gc);
+            c.n += __builtin_popcountll(m.n);
+            c.lower += __builtin_popcountll(m.lower);
+        }
+        return 0;
+    }
+};
+
+// X of with_extras<K, X>, 0 for plain kernels
+template <class K>
+constexpr unsigned extras_of = 0;
+template <class K, unsigned X>
+constexpr unsigned extras_of<with_extras<K, X>> = X;
+
+// calls f.template operator()<K>() for every kernel built in
+template <class F>
+static void for_each_kernel(F &&f) {
+    f.template operator()<lut8>();
+    f.template operator()<lut16>();
+    f.template operator()<swar64>();
+#ifdef __SSSE3__
+    f.template operator()<ssse3>();
+#endif
+#ifdef __AVX2__
+    f.template operator()<avx2>();
+#endif
+#if defined(__AVX512BW__) && defined(__AVX512VBMI__)
+    f.template operator()<avx512>();
+#endif
+}
+
+static inline std::string kernel_names() {
+    std::string names;
+    for_each_kernel([&]<class K>() { names += (names.empty() ? "" : ", ") + std::string(K::name); });
+    return names;
+}
+
+// f<K>() for kernel called name, "auto" is default_kernel
+template <class F>
+static void with_kernel(std::string_view name, F &&f) {
+    if (name == "auto")
+        return f.template operator()<default_kernel>();
+    auto found = false;
+    for_each_kernel([&]<class K>() {
+        if (!found && name == K::name) {
+            found = true;
+            f.template operator()<K>();
+        }
+    });
+    if (!found)
+        throw std::invalid_argument("unknown kernel " + std::string(name) + ", built: " + kernel_names());
+}
+
+}
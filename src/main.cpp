@@ -2,6 +2,9 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <algorithm>
+
+#include "simd_reverse.hpp"
 
 
 /*
@@ -102,7 +105,7 @@ namespace {
             return;
         }
         end--;
-        std::reverse(begin, end);
+        revcomp::simd_reverse(begin, end);
     }
 
     void read_up_to(istream& in, unsafe_vector& out, char delim) {
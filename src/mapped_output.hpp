@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+/*
+  Output file mapped for writing.
+
+  Output size == input size (fasta.hpp), so a regular file on stdout can be sized up
+  front and mapped MAP_SHARED: transform writes straight into page cache, there is
+  no write() copy. Ragged records change the size: the mapping grows when output
+  needs more and the file ends where output does. For records bigger than LLC the bytes go through a small staging
+  tile and non-temporal stores, so GBs of output we never read back don't evict input
+  and tables from caches.
+*/
+
+namespace revcomp {
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/*
+  Copy with non-temporal stores, dst gets 32B aligned after a memcpy head.
+  Caller issues _mm_sfence() before anybody else may see the data (munmap, write).
+*/
+static inline void stream_copy(char *dst, const char *src, size_t n) {
+    auto head = std::min(n, size_t(-uintptr_t(dst) & 31));
+    memcpy(dst, src, head);
+    dst += head, src += head, n -= head;
+#ifdef __AVX2__
+    for (; n >= 32; dst += 32, src += 32, n -= 32)
+        _mm256_stream_si256((__m256i*)dst, _mm256_loadu_si256((const __m256i*)src));
+#else
+    for (; n >= 16; dst += 16, src += 16, n -= 16)
+        _mm_stream_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+#endif
+    memcpy(dst, src, n);
+}
+
+class output_map {
+public:
+    /*
+      nullptr when fd can't be mapped and caller stays with write(): not a regular
+      file, O_APPEND, or a shell which already wrote something (offset > 0).
+      Shell opens "> file" write-only and shared writable mapping needs O_RDWR, so
+      the file is reopened through /proc.
+    */
+    static std::unique_ptr<output_map> open(int fd, size_t size, const struct stat &st) {
+        auto flags = fcntl(fd, F_GETFL);
+        if (!S_ISREG(st.st_mode) || size == 0 || flags < 0 || (flags & O_APPEND) ||
+            lseek(fd, 0, SEEK_CUR) != 0)
+            return nullptr;
+        auto rw = ::open(("/proc/self/fd/" + std::to_string(fd)).c_str(), O_RDWR | O_CLOEXEC);
+        if (rw < 0)
+            return nullptr;
+        return std::unique_ptr<output_map>(new output_map(fd, rw, size, st));
+    }
+    output_map(const output_map&) = delete;
+    output_map& operator=(const output_map&) = delete;
+
+    // file offset (and size, if we made it bigger) ends up where write() would leave it
+    ~output_map() {
+        _mm_sfence();
+        munmap(data, size);
+        if (used < size && size > kept && ftruncate(rw, std::max(used, kept)))
+            perror("revcomp: ftruncate");
+        close(rw);
+        lseek(fd, used, SEEK_SET);
+    }
+
+    /*
+      Fault pages [0, end) writable ahead of transform, in 4MB steps. One madvise per
+      step instead of a page fault per 4KB, kernels before 5.14 just fault as usual.
+    */
+    void populate(size_t end) {
+        if (end > size)
+            grow(end);
+        if (end <= populated)
+            return;
+        auto to = std::min(size, std::max(end, populated + (size_t(4) << 20)));
+        auto from = populated & ~size_t(4095);
+        if (populate_ok && madvise(data + from, to - from, MADV_POPULATE_WRITE))
+            populate_ok = false;
+        populated = to;
+    }
+
+    char *data = nullptr;
+    size_t size;
+    size_t used = 0;    // bytes of output in it, set by output_buffer
+
+private:
+    output_map(int fd, int rw, size_t size, const struct stat &st)
+        : size(size), fd(fd), rw(rw), kept(st.st_size) {
+        auto fail = [&](const char *what) {
+            auto err = errno;
+            close(rw);
+            throw std::system_error(err, std::generic_category(), what);
+        };
+        if (size_t(st.st_size) < size && ftruncate(rw, size))
+            fail("ftruncate");
+        auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, rw, 0);
+        if (p == MAP_FAILED)
+            fail("mmap");
+        data = static_cast<char*>(p);
+    }
+
+    // output longer than input: file and mapping get an 1/8 more at least, data may move
+    void grow(size_t end) {
+        auto to = std::max(end, size + size / 8);
+        _mm_sfence();
+        if (to > kept && ftruncate(rw, to))
+            throw std::system_error(errno, std::generic_category(), "ftruncate");
+        auto p = mremap(data, size, to, MREMAP_MAYMOVE);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mremap");
+        data = static_cast<char*>(p);
+        size = to;
+    }
+
+    int fd, rw;
+    size_t kept;    // size of the file before
+    size_t populated = 0;
+    bool populate_ok = true;
+};
+
+}
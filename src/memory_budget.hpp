@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+
+#include "tuning.hpp"
+
+/*
+  revcomp --max-memory=SIZE
+
+  rev1/rev2 size their buffer from fstat, main4/main6 grow to 512MB and stream engine
+  stages whole record, so a container limit below the input or the biggest record
+  means OOM kill. With a budget every engine stays under it:
+
+    - auto picks memory engine only for inputs up to a quarter of it (mapped input is
+      page cache charged to the cgroup, index of short reads is up to half of input
+      again), pread for bigger regular files - its memory does not depend on input
+    - output batches and read chunks are halved until engine buffers take at most
+      half of it (fit_to_budget)
+    - stream and pipeline engines get the rest for staged residues, a record bigger
+      than that is spilled to an unnamed file in $TMPDIR (or /tmp) and read back when
+      it's emitted (fused.hpp)
+
+  Staging holds reverse-complement of residues so far, so spilled pieces are emitted
+  after the staged ones, the last spilled first, each read back in staging-sized parts.
+  ~8MB (budget_overhead) is left for code, libc and stacks.
+*/
+
+namespace revcomp {
+
+constexpr size_t budget_overhead = 8 << 20;
+
+// biggest input memory engine may map within budget
+static inline size_t in_memory_limit(size_t budget) {
+    return budget / 4;
+}
+
+// bytes of buffers engine allocates with tuning t, staging not counted
+static inline size_t buffer_memory(const tuning &t, const std::string &engine, size_t threads) {
+    if (engine == "memory")
+        return t.write_batch * (threads + 1);
+    if (engine == "pread")
+        return t.index_block + 2 * t.write_batch + t.read_chunk;
+    if (engine == "pipeline")
+        return t.write_batch + t.read_chunk * 4 * (1 + 5 * threads);
+    return t.read_chunk + t.write_batch;
+}
+
+/*
+  Shrink buffers of t to fit engine into budget bytes, returns how many bytes of
+  staged residues each transform thread may hold before it spills. output_slots are
+  write_batch sized buffers of direct_output (--output=direct).
+*/
+static inline size_t fit_to_budget(tuning &t, const std::string &engine, size_t threads, size_t budget,
+                                   size_t output_slots = 0) {
+    constexpr size_t min_batch = 64 << 10, min_chunk = 4 << 10;
+    auto usable = budget > budget_overhead ? budget - budget_overhead : 0;
+    auto buffers = [&] { return buffer_memory(t, engine, threads) + output_slots * t.write_batch; };
+    while (buffers() > usable / 2) {
+        if (t.write_batch > min_batch && t.write_batch >= t.read_chunk)
+            t.write_batch /= 2;
+        else if (t.read_chunk > min_chunk)
+            t.read_chunk /= 2;
+        else {
+            auto needs = (2 * buffers() + budget_overhead + (1 << 20) - 1) >> 20;    // MB, rounded up
+            throw std::invalid_argument("--max-memory=" + size_text(budget) + " is too small for " + engine +
+                                        " engine, it needs " + std::to_string(needs) + "M");
+        }
+    }
+    t.tile = std::min(t.tile, t.write_batch);
+    return (usable - buffers()) / std::max<size_t>(threads, 1);
+}
+
+// unnamed file for spilled staging, disappears when closed
+class spill_file {
+public:
+    spill_file() {
+        const char *dir = getenv("TMPDIR");
+        if (!dir || !*dir)
+            dir = "/tmp";
+        fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), std::string("spill file in ") + dir);
+    }
+    spill_file(const spill_file&) = delete;
+    spill_file& operator=(const spill_file&) = delete;
+    ~spill_file() { close(fd); }
+
+    // n bytes to the end, returns their offset
+    size_t append(const char *p, size_t n) {
+        auto offset = size;
+        for (size_t done = 0; done < n;) {
+            auto bytes = pwrite(fd, p + done, n - done, off_t(size));
+            if (bytes < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "spill file write");
+            }
+            done += bytes;
+            size += bytes;
+        }
+        return offset;
+    }
+
+    void read(char *p, size_t n, size_t offset) {
+        for (size_t done = 0; done < n;) {
+            auto bytes = pread(fd, p + done, n - done, off_t(offset + done));
+            if (bytes <= 0) {
+                if (bytes < 0 && errno == EINTR)
+                    continue;
+                throw std::system_error(bytes ? errno : EIO, std::generic_category(), "spill file read");
+            }
+            done += bytes;
+        }
+    }
+
+    // drop everything, blocks go back to the filesystem
+    void clear() {
+        if (ftruncate(fd, 0))
+            throw std::system_error(errno, std::generic_category(), "spill file truncate");
+        size = 0;
+    }
+
+private:
+    int fd;
+    size_t size = 0;
+};
+
+}
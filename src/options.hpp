@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "tuning.hpp"
+
+/*
+  revcomp command line. Every option is --name or --name=value.
+*/
+
+namespace revcomp {
+
+struct options {
+    std::string engine = "auto";
+    std::string kernel = "auto";
+    std::string alphabet = "dna";
+    std::string config;     // empty - default_config_path()
+    size_t threads = 0;     // 0 - from topology and input size
+    std::string output = "auto";
+    bool drop_input_cache = false;
+    std::string validate;   // empty - off, fail or warn
+    std::string record_stats;   // empty - off
+    std::string checksums;      // empty - off
+    std::string verify;         // empty - off
+    size_t max_memory = 0;      // 0 - no limit
+    std::string batch;          // empty - stdin to stdout
+    unsigned kmers = 0;         // 0 - reverse-complement, K - canonical k-mers instead
+    bool kmer_hash = false;
+    std::string search;         // empty - off, patterns separated by commas
+    bool calibrate = false;
+    bool stats = false;
+    bool perf = false;
+    bool help = false;
+};
+
+constexpr const char *usage =
+    "usage: revcomp [options] < in.fa > out.fa\n"
+    "       revcomp [options] --batch=LIST\n"
+    "  --engine=NAME   auto (default), memory, pread, stream or pipeline\n"
+    "  --kernel=NAME   complement kernel: auto (widest built), lut8, lut16, swar64, ssse3,\n"
+    "                  avx2 or avx512, see revcomp_bench\n"
+    "  --alphabet=A    complement: dna (default), rna (U instead of T) or mapping file\n"
+    "  --config=PATH   tuning config (default $REVCOMP_CONFIG or ~/.config/revcomp.conf)\n"
+    "  --threads=N     transform threads of memory engine (default: cpus allowed by\n"
+    "                  affinity and cgroup quota, 1 for inputs under 2 output batches)\n"
+    "                  and of pipeline engine (default 1)\n"
+    "  --output=MODE   auto (default), write, map or direct - map: regular file on stdout\n"
+    "                  is mapped and filled in place, records bigger than LLC with non-temporal\n"
+    "                  stores; direct: written with O_DIRECT, past page cache\n"
+    "  --drop-input-cache  with --output=direct: posix_fadvise(DONTNEED) input once written\n"
+    "  --validate=MODE fail or warn on bytes outside the alphabet, reports record name and\n"
+    "                  1-based position of the first one\n"
+    "  --stats-per-record=PATH  length, GC, N and lowercase per record, TSV or JSON lines\n"
+    "                  if PATH ends with .json, - is stderr\n"
+    "  --checksums=PATH  CRC32C of every output record and of whole output, - is stderr\n"
+    "  --verify=PATH   compare output with checksums written before, fail on mismatch\n"
+    "  --max-memory=SIZE  memory budget like 512M or 4G: smaller buffers, pread instead of\n"
+    "                  memory engine for bigger inputs, records which don't fit spill to $TMPDIR\n"
+    "  --batch=LIST    every \"input output\" pair of paths listed in LIST (- is stdin), one\n"
+    "                  per line, on one pool of --threads workers sharing files and blocks\n"
+    "  --kmers=K       canonical k-mers (K up to 32) instead of reverse-complement: 2-bit\n"
+    "                  words as little-endian uint64, no k-mer over N or other non-ACGT\n"
+    "  --kmer-hash     with --kmers: invertible hash of each canonical k-mer instead\n"
+    "  --search=P,...  where IUPAC patterns P occur on either strand, as BED, instead of\n"
+    "                  reverse-complement\n"
+    "  --calibrate     measure block/buffer sizes for this host and save them to config\n"
+    "  --stats         print per-phase metrics as JSON to stderr\n"
+    "  --perf          --stats + hardware counters per phase\n"
+    "  --help          this message\n";
+
+static inline options parse_options(int argc, char **argv) {
+    options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto eq = arg.find('=');
+        auto name = arg.substr(0, eq);
+        auto value = eq == arg.npos ? std::string_view{} : arg.substr(eq + 1);
+        auto needs_value = [&] {
+            if (eq == arg.npos || value.empty())
+                throw std::invalid_argument(std::string(name) + " needs a value");
+            return std::string(value);
+        };
+
+        if (name == "--engine")
+            opts.engine = needs_value();
+        else if (name == "--kernel")
+            opts.kernel = needs_value();
+        else if (name == "--alphabet")
+            opts.alphabet = needs_value();
+        else if (name == "--config")
+            opts.config = needs_value();
+        else if (name == "--threads")
+            opts.threads = std::stoul(needs_value());
+        else if (name == "--output")
+            opts.output = needs_value();
+        else if (name == "--drop-input-cache")
+            opts.drop_input_cache = true;
+        else if (name == "--validate")
+            opts.validate = needs_value();
+        else if (name == "--stats-per-record")
+            opts.record_stats = needs_value();
+        else if (name == "--checksums")
+            opts.checksums = needs_value();
+        else if (name == "--verify")
+            opts.verify = needs_value();
+        else if (name == "--max-memory")
+            opts.max_memory = parse_size(needs_value());
+        else if (name == "--batch")
+            opts.batch = needs_value();
+        else if (name == "--kmers") {
+            opts.kmers = unsigned(std::stoul(needs_value()));
+            if (opts.kmers < 1 || opts.kmers > 32)
+                throw std::invalid_argument("--kmers needs K from 1 to 32");
+        }
+        else if (name == "--kmer-hash")
+            opts.kmer_hash = true;
+        else if (name == "--search")
+            opts.search = needs_value();
+        else if (name == "--calibrate")
+            opts.calibrate = true;
+        else if (name == "--stats")
+            opts.stats = true;
+        else if (name == "--perf")
+            opts.perf = true;
+        else if (name == "--help" || name == "-h")
+            opts.help = true;
+        else
+            throw std::invalid_argument("unknown option " + std::string(arg));
+    }
+    return opts;
+}
+
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+#include "checksum.hpp"
+#include "direct_output.hpp"
+#include "mapped_output.hpp"
+#include "stats.hpp"
+
+/*
+  Output coalescing.
+
+  Per record cpp-7 used to do sendfile(header) + pread/write per 61KB block + write("\n").
+  For read-level FASTA (millions of ~100B records) it's millions of syscalls and nearly
+  whole time is sys. Now headers, bodies and newlines go to one reused 4MB buffer which
+  is flushed with single write when it's full.
+
+  300k records x ~75B (33MB) to /dev/null:  2.84s -> 0.084s
+  revcomp-input x 24000 (245MB):            0.96s -> 0.57s
+
+  After direct_to() they fill slots of direct_output (direct_output.hpp) in place,
+  its writer thread writes them with O_DIRECT.
+
+  After map_to() the same calls fill output_map instead: reserve() points into the
+  mapping, except for records announced by begin_record() as bigger than LLC - those
+  are staged in the buffer and flushed with non-temporal stores.
+
+  With checksum_to() every committed or put piece also goes to output_checksums
+  (checksum.hpp) while it's hot, engines mark where records end.
+
+  After hand_off_to() full buffers are passed on instead of written, with the record
+  ends in them if checksums need them - transform threads of pipeline engine fill
+  them and writer thread put_chunk()s them into the real output in order.
+*/
+
+namespace revcomp {
+
+// write all n bytes, retry on short writes and EINTR
+static inline void write_all(int fd, const char *p, size_t n, stats &st) {
+    while (n) {
+        auto bytes = write(fd, p, n);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        st.syscall(phase::write, bytes);
+        p += bytes;
+        n -= bytes;
+    }
+}
+
+// end of record (or of text before first one) at byte `at` of a handed off buffer
+struct record_end {
+    size_t at;
+    std::string header;
+    bool preamble;
+};
+
+class output_buffer {
+public:
+    // gets full buffer, `used` bytes of it and ends, swaps in empty one of the same size
+    using handoff = std::function<void(std::vector<char> &buf, size_t used, std::vector<record_end> &ends)>;
+
+    output_buffer(int fd, stats &st, size_t capacity = 1 << 22) : fd(fd), st(st), buf(capacity) {}
+    output_buffer(const output_buffer&) = delete;
+    output_buffer& operator=(const output_buffer&) = delete;
+
+    /*
+      Write to mapping from now on. Records above nontemporal_above bytes are
+      transformed into staging buffer of tile bytes and streamed out of it.
+    */
+    void map_to(output_map &target, size_t nontemporal_above, size_t tile) {
+        flush();
+        map = &target;
+        streaming_above = nontemporal_above;
+        buf.resize(tile);
+    }
+
+    // O_DIRECT from now on, caller finish()es target after the last flush
+    void direct_to(direct_output &target) {
+        flush();
+        direct = &target;
+    }
+
+    // flush() calls next even with nothing in buffer, so it can mark end of a job
+    void hand_off_to(handoff next, bool keep_ends) {
+        hand_off = std::move(next);
+        keeping_ends = keep_ends;
+    }
+
+    // --checksums / --verify
+    void checksum_to(output_checksums &target) { sums = &target; }
+    bool checksumming() const { return sums || keeping_ends; }
+
+    // output so far is text before the first record / record with this header
+    void end_preamble() {
+        if (sums)
+            sums->end_preamble();
+        if (keeping_ends)
+            ends.push_back({used, {}, true});
+    }
+    void end_record(std::string_view header) {
+        if (sums)
+            sums->end_record(header);
+        if (keeping_ends)
+            ends.push_back({used, std::string(header), false});
+    }
+
+    // size of record which follows, only mapped output cares
+    void begin_record(size_t bytes) {
+        if (map && (bytes > streaming_above) != streaming) {
+            flush();
+            streaming = !streaming;
+        }
+    }
+
+    // space for n bytes, they become part of output after commit(n)
+    char *reserve(size_t n) {
+        if (direct)
+            return direct->reserve(n);
+        if (map && !streaming) {
+            map->populate(pos + n);
+            return map->data + pos;
+        }
+        if (used + n > buf.size()) {
+            flush();
+            if (n > buf.size())
+                buf.resize(n);
+        }
+        return buf.data() + used;
+    }
+    void commit(size_t n) {
+        if (direct) {
+            sum(direct->end(), n);
+            direct->commit(n);
+        } else if (map && !streaming) {
+            sum(map->data + pos, n);
+            advance(n);
+        } else {
+            sum(buf.data() + used, n);
+            used += n;
+        }
+    }
+    void append(const char *p, size_t n) { memcpy(reserve(n), p, n); commit(n); }
+
+    // bigger chunks than buffer go directly, no point to copy them
+    void put(const char *p, size_t n) {
+        if (map) {
+            flush();
+            sum(p, n);
+            map->populate(pos + n);
+            auto dst = map->data + pos;
+            advance(n);
+            streaming ? stream_copy(dst, p, n) : (void)memcpy(dst, p, n);
+            return;
+        }
+        if (n < buf.size() || hand_off || direct) {
+            for (size_t k = 0; k < n; k += buf.size())
+                append(p + k, std::min(n - k, buf.size()));
+            return;
+        }
+        flush();
+        sum(p, n);
+        phase_scope scope{st, phase::write};
+        write_all(fd, p, n, st);
+    }
+
+    // handed off buffer, record ends in it go to checksums
+    void put_chunk(const char *p, size_t n, const std::vector<record_end> &chunk_ends) {
+        size_t done = 0;
+        for (auto &e : chunk_ends) {
+            put(p + done, e.at - done);
+            done = e.at;
+            e.preamble ? end_preamble() : end_record(e.header);
+        }
+        put(p + done, n - done);
+    }
+
+    void flush() {
+        if (direct)
+            return;
+        phase_scope scope{st, phase::write};
+        if (hand_off) {
+            hand_off(buf, used, ends);
+            used = 0;
+            return;
+        }
+        if (map) {
+            map->populate(pos + used);
+            auto dst = map->data + pos;
+            advance(used);
+            stream_copy(dst, buf.data(), used);
+            used = 0;
+            return;
+        }
+        write_all(fd, buf.data(), used, st);
+        used = 0;
+    }
+
+private:
+    void sum(const char *p, size_t n) {
+        if (sums)
+            sums->add(p, n);
+    }
+
+    void advance(size_t n) {
+        pos += n;
+        map->used = pos;
+        st.processed(phase::write, n);
+    }
+
+    int fd;
+    stats &st;
+    std::vector<char> buf;
+    size_t used = 0;
+
+    direct_output *direct = nullptr;
+
+    output_map *map = nullptr;
+    size_t pos = 0;             // bytes in mapping
+    size_t streaming_above = 0;
+    bool streaming = false;     // current record goes through buf and stream_copy
+
+    output_checksums *sums = nullptr;
+
+    handoff hand_off;
+    bool keeping_ends = false;
+    std::vector<record_end> ends;   // in buf, when keeping_ends
+};
+
+}
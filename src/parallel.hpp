@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "topology.hpp"
+
+/*
+  Ordered parallel transform: jobs 0..n-1 are produced by pinned workers into their
+  own buffers and consumed (written) by calling thread strictly in order.
+
+  Worker t does jobs t, t+T, t+2T... alternating two buffers, so it's computing next
+  job while caller writes previous one. Both buffers are first-touched by the worker
+  on its node (topology.hpp) - output bytes are written by the cpu next to them and
+  read back by write() which is one sequential pass.
+
+  spsc_ring connects threads of pipeline engine (engine_pipeline.hpp).
+*/
+
+namespace revcomp {
+
+/*
+  Single-producer single-consumer ring of n reused slots. head is advanced only by
+  producer, tail only by consumer, each on its own cache line, so passing a slot is
+  one release store and one acquire load, no lock. A side blocks (futex, atomic::wait)
+  only when the ring is full / empty. close() sets top bit of both counters: waiters
+  wake up and claim() / front() return nullptr from then on.
+*/
+template <class T>
+class spsc_ring {
+public:
+    explicit spsc_ring(size_t n) : slots(n) {}
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // producer: slot to fill, it's passed on by publish()
+    T *claim() {
+        while (true) {
+            auto h = head.load(std::memory_order_relaxed), t = tail.load(std::memory_order_acquire);
+            if ((h | t) & closed)
+                return nullptr;
+            if (h - t < slots.size())
+                return &slots[h % slots.size()];
+            tail.wait(t, std::memory_order_acquire);
+        }
+    }
+    void publish() {
+        head.fetch_add(1, std::memory_order_release);
+        head.notify_one();
+    }
+
+    // consumer: oldest published slot, it's given back by release()
+    T *front() {
+        while (true) {
+            auto t = tail.load(std::memory_order_relaxed), h = head.load(std::memory_order_acquire);
+            if ((h | t) & closed)
+                return nullptr;
+            if (h != t)
+                return &slots[t % slots.size()];
+            head.wait(h, std::memory_order_acquire);
+        }
+    }
+    void release() {
+        tail.fetch_add(1, std::memory_order_release);
+        tail.notify_one();
+    }
+
+    // both sides give up, e.g. other stage failed
+    void close() {
+        head.fetch_or(closed);
+        tail.fetch_or(closed);
+        head.notify_all();
+        tail.notify_all();
+    }
+
+private:
+    static constexpr size_t closed = size_t(1) << 63;
+
+    std::vector<T> slots;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+template <class Produce, class Consume>
+static void run_ordered(const topology &topo, size_t threads, size_t jobs, size_t buffer_size,
+                        Produce produce, Consume consume) {
+    enum : int { free_slot, ready, failed, stopped };
+    struct slot {
+        std::unique_ptr<local_buffer> buffer;
+        std::atomic<int> state{free_slot};
+        size_t size = 0;
+    };
+
+    auto slots = std::make_unique<slot[]>(2 * threads);
+    for (size_t i = 0; i < 2 * threads; i++)
+        slots[i].buffer = std::make_unique<local_buffer>(buffer_size);
+    std::vector<std::exception_ptr> errors(threads);
+    std::atomic<bool> stop{false};
+
+    auto worker = [&](size_t t) {
+        auto job = t;
+        try {
+            auto &cpu = topo.place(t);
+            pin_current_thread(cpu);
+            slots[t].buffer->touch(topo, cpu.node);
+            slots[t + threads].buffer->touch(topo, cpu.node);
+            for (; job < jobs; job += threads) {
+                auto &s = slots[job % (2 * threads)];
+                s.state.wait(ready);
+                if (stop)
+                    return;
+                s.size = produce(job, s.buffer->data);
+                s.state = ready;
+                s.state.notify_all();
+            }
+        } catch (...) {
+            errors[t] = std::current_exception();
+            if (job < jobs) {
+                slots[job % (2 * threads)].state = failed;
+                slots[job % (2 * threads)].state.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto finish = [&] {
+        stop = true;
+        for (size_t i = 0; i < 2 * threads; i++) {
+            slots[i].state = stopped;
+            slots[i].state.notify_all();
+        }
+        for (auto &w : workers)
+            w.join();
+    };
+
+    try {
+        for (size_t t = 0; t < threads; t++)
+            workers.emplace_back(worker, t);
+        for (size_t job = 0; job < jobs; job++) {
+            auto &s = slots[job % (2 * threads)];
+            s.state.wait(free_slot);
+            if (s.state == failed)
+                std::rethrow_exception(errors[job % threads]);
+            consume(job, s.buffer->data, s.size);
+            s.state = free_slot;
+            s.state.notify_all();
+        }
+    } catch (...) {
+        finish();
+        throw;
+    }
+    finish();
+}
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+  Hardware counters per engine phase (--perf), no need to attach external perf.
+
+  * two perf_event_open groups - core PMU usually has 4 general purpose counters
+    (+ fixed cycles/instructions) so all 6 events in one group may never be scheduled.
+    Group is read with one read() returning all values + time_enabled/time_running,
+    if kernel multiplexed the group we scale like perf does: value * enabled / running.
+
+  * how to read it:
+    - low IPC + high llc_misses/KB - memory bound (WS >> L3, see main1..main3 in rev3)
+    - high dtlb_misses/KB - TLB bound, hugepages should help (main4: ~60ms)
+    - IPC > 2 with few misses - compute bound, look at transform kernel
+
+  * perf_event_paranoid > 1 forbids kernel counting for non-root, then we count
+    only user space. Without PMU (some VMs) counters are just unavailable.
+*/
+
+namespace revcomp {
+
+constexpr std::array counter_names = {"cycles", "instructions", "branch_misses",
+                                      "l1d_misses", "llc_misses", "dtlb_misses"};
+using counter_values = std::array<double, counter_names.size()>;
+
+class perf_counters {
+public:
+    perf_counters() {
+        constexpr auto cache = [](uint64_t id, uint64_t op, uint64_t result) {
+            return id | (op << 8) | (result << 16);
+        };
+        constexpr std::array<std::pair<uint32_t, uint64_t>, counter_names.size()> events = {{
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                                       PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                                       PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                                       PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        }};
+        // first 3 events go to group 0, rest to group 1
+        for (size_t i = 0; i < events.size(); i++) {
+            auto &g = groups[i / 3];
+            slots[i] = {i / 3, -1};
+            auto fd = open_event(events[i].first, events[i].second, g.leader);
+            if (fd == -1)
+                continue;
+            if (g.leader == -1)
+                g.leader = fd;
+            g.fds[g.count] = fd;
+            slots[i].index = g.count++;
+        }
+        for (auto &g : groups)
+            if (g.leader != -1)
+                ioctl(g.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    ~perf_counters() {
+        for (auto &g : groups)
+            for (int i = 0; i < g.count; i++)
+                close(g.fds[i]);
+    }
+
+    bool available(size_t counter) const { return slots[counter].index != -1; }
+
+    bool available() const {
+        return groups[0].leader != -1 || groups[1].leader != -1;
+    }
+
+    // cumulative (scaled) values since construction
+    counter_values read() const {
+        counter_values result{};
+        std::array<std::array<double, 3>, 2> scaled{};
+        for (size_t g = 0; g < groups.size(); g++) {
+            if (groups[g].leader == -1)
+                continue;
+            struct { uint64_t nr, enabled, running, values[3]; } data{};
+            if (::read(groups[g].leader, &data, sizeof(data)) <= 0 || data.running == 0)
+                continue;
+            for (uint64_t i = 0; i < data.nr && i < 3; i++)
+                scaled[g][i] = double(data.values[i]) * double(data.enabled) / double(data.running);
+        }
+        for (size_t i = 0; i < slots.size(); i++)
+            if (slots[i].index != -1)
+                result[i] = scaled[slots[i].group][slots[i].index];
+        return result;
+    }
+
+private:
+    static int open_event(uint32_t type, uint64_t config, int group_fd) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group_fd == -1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        auto fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+        if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+            attr.exclude_kernel = 1;
+            fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+        }
+        return int(fd);
+    }
+
+    struct group {
+        int leader = -1;
+        int count = 0;
+        std::array<int, 3> fds{};
+    };
+    struct slot {
+        size_t group;
+        int index;
+    };
+
+    std::array<group, 2> groups;
+    std::array<slot, counter_names.size()> slots{};
+};
+
+}
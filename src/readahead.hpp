@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <fcntl.h>
+
+#include "engine.hpp"
+
+/*
+  Readahead for a record read backward (pread engine, put_windowed).
+
+  Kernel readahead follows forward sequential reads only. Windows of a record going
+  from its end to its start look random to it, so on a cold file every read_chunk
+  pread waits for the device with nothing else queued. Here, before a window is read,
+  the `depth` windows below it are posix_fadvise(WILLNEED)ed: the kernel queues those
+  reads and returns, so the device works ahead of the transform. Every range is asked
+  for once, a call covers what was not asked for yet (usually one window).
+
+  depth adapts to what reads take: a window slower than 1 byte/ns (a page cache copy
+  is several times faster) waited for the device, depth doubles up to max_depth; after
+  `calm` cached windows in a row it halves down to min_depth, so cached files don't
+  pay for fadvise of many windows ahead.
+
+  The index thread scans a record forward before it's read back, that usually leaves
+  it cached. It's not when the record is bigger than what page cache keeps (a
+  chromosome under a cgroup memory limit) or was evicted meanwhile. onerec.fa (213MB,
+  one record) on ext4 on virtio disk, dropped from cache after indexing: 0.86-2.3s
+  without, 0.27s with - dd iflag=direct of the file takes 0.23-0.37s, a cached run
+  0.21s. Cached: no difference.
+*/
+
+namespace revcomp {
+
+class backward_readahead {
+public:
+    static constexpr size_t min_depth = 2, max_depth = 256, calm = 64;
+
+    explicit backward_readahead(int fd) : fd(fd) {}
+
+    // new record, its windows go down to lowest
+    void start(size_t lowest) {
+        this->lowest = lowest;
+        asked = ~size_t(0);
+    }
+
+    // pread [offset, offset + n) after windows below it are asked for
+    size_t read(char *p, size_t n, size_t offset, stats &st) {
+        auto ahead = depth * n;
+        auto want = offset - lowest > ahead ? offset - ahead : lowest;
+        auto until = std::min(asked, offset);
+        if (advise && want < until) {
+            if (posix_fadvise(fd, off_t(want), off_t(until - want), POSIX_FADV_WILLNEED))
+                advise = false;     // pipe
+            st.syscall(phase::read, 0);
+            asked = want;
+        }
+        auto t0 = monotonic_now();
+        auto bytes = pread_full(fd, p, n, offset, st);
+        if (monotonic_now() - t0 > n) {
+            depth = std::min(depth * 2, max_depth);
+            cached = 0;
+        } else if (++cached == calm) {
+            depth = std::max(depth / 2, min_depth);
+            cached = 0;
+        }
+        return bytes;
+    }
+
+private:
+    int fd;
+    bool advise = true;
+    size_t depth = min_depth, cached = 0;
+    size_t lowest = 0, asked = 0;
+};
+
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <cerrno>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "fasta.hpp"
+#include "kernels.hpp"
+#include "validate.hpp"
+
+/*
+  revcomp --stats-per-record=PATH
+
+  One row per record: name, length, G+C, N and lowercase (soft-masked) residues, GC
+  content (G+C of non-N residues) and lowercase fraction. TSV with a header line, or
+  JSON lines when PATH ends with .json, - is stderr.
+
+  Counts come from with_extras<K, count_bases> (kernels.hpp): the vector which is
+  complemented is also compared against the classes and the masks are popcounted, so
+  there is no second pass over the bytes - the same which a separate tool run after
+  revcomp would pay in full.
+
+  Only runs with this option pay for it: engines get with_extras<K, count_bases> then
+  and the plain K otherwise, whose code has no counting in it. avx512 on 1 vCPU VM,
+  rdtsc per byte: 0.086 plain (0.087 before extras existed), 0.20 counting on 16KB
+  runs, 0.23 / 0.33 on 60B lines; big.fa (245MB, 60 columns) memory engine transform
+  phase 170-183ms plain, 221-229ms counting.
+*/
+
+namespace revcomp {
+
+class record_table {
+public:
+    explicit record_table(const std::string &path)
+        : json(path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0) {
+        out = path == "-" ? stderr : fopen(path.c_str(), "w");
+        if (!out)
+            throw std::system_error(errno, std::generic_category(), path);
+        if (!json) {
+            fputs("name", out);
+            for (auto column : columns)
+                fprintf(out, "\t%s", column);
+            fputs("\n", out);
+        }
+    }
+    record_table(const record_table&) = delete;
+    record_table& operator=(const record_table&) = delete;
+    ~record_table() {
+        if (out && out != stderr)
+            fclose(out);
+    }
+
+    // to_chars into reused line, printf of two doubles per record was most of the cost on short reads
+    void row(std::string_view header, uint64_t length, const base_counts &c) {
+        auto acgt = length - c.n;
+        uint64_t counts[] = {length, c.gc, c.n, c.lower};
+        double fractions[] = {acgt ? double(c.gc) / double(acgt) : 0.0,
+                              length ? double(c.lower) / double(length) : 0.0};
+        line.clear();
+        if (json)
+            line += "{\"name\":\"";
+        for (auto ch : record_name(header)) {
+            if (json && (ch == '"' || ch == '\\'))
+                line += '\\';
+            if (!json || uint8_t(ch) >= 0x20)
+                line += ch;
+        }
+        if (json)
+            line += '"';
+        for (size_t i = 0; i < std::size(columns); i++) {
+            if (json)
+                line.append(",\"").append(columns[i]).append("\":");
+            else
+                line += '\t';
+            char number[32];
+            auto end = i < 4 ? std::to_chars(number, std::end(number), counts[i]).ptr
+                             : std::to_chars(number, std::end(number), fractions[i - 4],
+                                             std::chars_format::fixed, 4).ptr;
+            line.append(number, end);
+        }
+        line += json ? "}\n" : "\n";
+        fwrite(line.data(), 1, line.size(), out);
+    }
+
+    // flush and check, errors of buffered writes show up only here
+    void close() {
+        auto failed = fflush(out) != 0 || ferror(out);
+        auto err = errno;
+        if (out != stderr)
+            failed |= fclose(out) != 0;
+        out = nullptr;
+        if (failed)
+            throw std::system_error(err, std::generic_category(), "--stats-per-record");
+    }
+
+private:
+    static constexpr const char *columns[] = {"length", "gc", "n", "lowercase", "gc_content",
+                                              "lowercase_fraction"};
+    FILE *out;
+    bool json;
+    std::string line;
+};
+
+// where engines put rows, set by revcomp when --stats-per-record is on
+static inline record_table *&record_stats_table() {
+    static record_table *table = nullptr;
+    return table;
+}
+
+/*
+  Kernel extras of one record: first byte outside the alphabet and base counts.
+  Engines take() after each transformed piece of a record and finish() at its end,
+  with plain kernels everything here is a no-op.
+*/
+template <class K>
+class record_extras {
+public:
+    static constexpr auto extras = extras_of<K>;
+
+    // header stays in memory until finish(), or is copied with add_header()
+    explicit record_extras(std::string_view header = {}) : header(header) {}
+
+    void add_header(const char *p, size_t n) {
+        if constexpr (extras != 0) {
+            copy.append(p, n);
+            header = copy;
+        }
+    }
+
+    // what kernel noted since last take, src[k] is body byte src_off + k
+    void take(const char *src, size_t src_off, size_t width) {
+        if constexpr (has_extra(extras, check_alphabet)) {
+            if (auto p = std::exchange(noted().invalid, nullptr)) {
+                auto k = src_off + size_t(p - src);
+                keep(k - k / (width + 1), uint8_t(*p));
+            }
+        }
+        take_counts();
+    }
+
+    // same for a run without newlines, src[0] is residue `first`
+    void take_run(const char *src, size_t first) {
+        if constexpr (has_extra(extras, check_alphabet)) {
+            if (auto p = std::exchange(noted().invalid, nullptr))
+                keep(first + size_t(p - src), uint8_t(*p));
+        }
+        take_counts();
+    }
+
+    // record with `residues` is done: report, row, start over for next one
+    void finish(size_t residues) {
+        report();
+        if constexpr (has_extra(extras, count_bases))
+            record_stats_table()->row(header, residues, std::exchange(counts, {}));
+        if constexpr (extras != 0)
+            copy.clear();
+        header = {};
+    }
+
+    // part of a record done by one job of threaded engine, counts are added to total
+    void finish_part(base_counts &total) {
+        report();
+        if constexpr (has_extra(extras, count_bases)) {
+            std::atomic_ref(total.gc).fetch_add(counts.gc, std::memory_order_relaxed);
+            std::atomic_ref(total.n).fetch_add(counts.n, std::memory_order_relaxed);
+            std::atomic_ref(total.lower).fetch_add(counts.lower, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static constexpr size_t none = ~size_t(0);
+    struct nothing {};
+
+    void keep(size_t r, uint8_t b) {
+        if (r < residue)
+            residue = r, byte = b;
+    }
+
+    void take_counts() {
+        if constexpr (has_extra(extras, count_bases))
+            counts += std::exchange(noted().counts, {});
+    }
+
+    void report() {
+        if constexpr (has_extra(extras, check_alphabet)) {
+            if (residue != none)
+                report_invalid(header, std::exchange(residue, none), byte);
+        }
+    }
+
+    std::string_view header;
+    [[no_unique_address]] std::conditional_t<extras != 0, std::string, nothing> copy;
+    size_t residue = none;
+    uint8_t byte = 0;
+    base_counts counts;
+};
+
+}
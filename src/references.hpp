@@ -0,0 +1,86 @@
+#pragma once
+
+#include <fcntl.h>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unordered_map>
+#include <vector>
+
+#include "engine.hpp"
+
+/*
+  Named reference FASTA files for revcompd: each one mapped (MAP_POPULATE, so pages
+  are warm before the first request) and indexed once with the memory engine's record
+  parse, sequences looked up by record name. Regions are cut straight from the
+  mapping by revcomp_region (fasta.hpp), no copy of the reference is made. That needs
+  every line of a record but the last as long as the first, a file with a ragged
+  record (fasta.hpp) is refused when it's loaded.
+  If a file has two records with the same name the first one is used.
+*/
+
+namespace revcomp {
+
+// unordered_map with string keys found by string_view
+struct name_hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+template <class T>
+using name_map = std::unordered_map<std::string, T, name_hash, std::equal_to<>>;
+
+class reference {
+public:
+    explicit reference(const std::string &path) {
+        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st)) {
+            auto err = errno;
+            if (fd != -1)
+                close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        try {
+            mem = std::make_unique<mapping>(fd, size_t(st.st_size), MAP_SHARED | MAP_POPULATE);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        auto data = mem->data;
+        auto size = mem->size;
+        auto p = data ? (const char*)memchr(data, '>', size) : nullptr;
+        for (auto pos = p ? size_t(p - data) : size; pos < size; pos = index.back().next) {
+            index.push_back(parse_record(data, size, pos));
+            auto &r = index.back();
+            if (r.ragged)
+                throw std::invalid_argument(path + ": lines of " +
+                                            std::string(record_name({data + r.header, r.body - r.header})) +
+                                            " differ in length, regions need one width - re-wrap it first");
+            by_name.try_emplace(std::string(record_name({data + r.header, r.body - r.header})), index.size() - 1);
+        }
+    }
+
+    // record of sequence called name, nullptr if there is none
+    const record *find(std::string_view name) const {
+        auto it = by_name.find(name);
+        return it == by_name.end() ? nullptr : &index[it->second];
+    }
+
+    const char *data() const { return mem->data; }
+    size_t sequences() const { return index.size(); }
+    const std::vector<record> &records() const { return index; }
+
+private:
+    std::unique_ptr<mapping> mem;
+    std::vector<record> index;
+    name_map<size_t> by_name;
+};
+
+using reference_set = name_map<std::unique_ptr<reference>>;
+
+}
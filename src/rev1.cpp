@@ -14,48 +14,63 @@
 #include <thread>
 #include <algorithm>
 
-constexpr auto margin = 60u;
+#include "simd_reverse.hpp"
+#include "stats.hpp"
 
-static inline uint64_t realtime_now() {
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    return ts.tv_sec * 1'000'000'000ULL + ts.tv_nsec;
-}
+constexpr auto margin = 60u;
 
-static unsigned get_buffer_capacity() {
+static size_t get_buffer_capacity() {
     struct stat fileinfo;
     fstat(fileno(stdin), &fileinfo);
     return fileinfo.st_size;
 }
 
-int main() {
+int main(int argc, char **argv) {
+    using revcomp::phase, revcomp::phase_scope;
+    revcomp::stats st{"rev1", argc, argv};
     const auto buffer_size = get_buffer_capacity();
     auto buffer = new char[buffer_size + 1];
     auto in = fileno(stdin);
 
-    auto t0 = realtime_now();
-    read(in, &buffer[0], buffer_size);
-    auto t1 = realtime_now();
-    //printf("read time: %zu ms\n", (t1-t0)/1'000'000);
+    // one read()/write() moves at most ~2GB (0x7ffff000), bigger inputs need a loop
+    {
+        phase_scope scope{st, phase::read};
+        for (size_t done = 0; done < buffer_size;) {
+            auto bytes = read(in, &buffer[done], buffer_size - done);
+            if (bytes <= 0)
+                break;
+            st.syscall(phase::read, bytes);
+            done += bytes;
+        }
+    }
 
     buffer[buffer_size] = '>';
 
-    t0 = realtime_now();
-    auto last = buffer_size;
-    auto *from = &buffer[0], *to = &buffer[last];
-    while (from < &buffer[last]) {
-        from = strchr(from, '\n')+1;
-        to = strchr(from, '>');
-        std::reverse(from, to-1);
-        from = to;
+    {
+        phase_scope scope{st, phase::transform};
+        auto last = buffer_size;
+        auto *from = &buffer[0], *to = &buffer[last];
+        while (from < &buffer[last]) {
+            from = strchr(from, '\n')+1;
+            to = strchr(from, '>');
+            revcomp::simd_reverse(from, to-1);
+            from = to;
+            st.records++;
+        }
+        st.processed(phase::transform, buffer_size);
     }
 
-    t1 = realtime_now();
-    t0 = realtime_now();
-
-    write(fileno(stdout), buffer, buffer_size);
-    t1 = realtime_now();
-    //printf("write time: %zu ms\n", (t1-t0)/1'000'000);
+    {
+        phase_scope scope{st, phase::write};
+        for (size_t done = 0; done < buffer_size;) {
+            auto bytes = write(fileno(stdout), buffer + done, buffer_size - done);
+            if (bytes <= 0)
+                break;
+            st.syscall(phase::write, bytes);
+            done += bytes;
+        }
+    }
     delete[] buffer;
+    st.print_json(stderr);
     return 0;
 }
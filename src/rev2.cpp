@@ -16,6 +16,9 @@
 #include <sys/mman.h>
 #include <string.h>
 
+#include "simd_reverse.hpp"
+#include "stats.hpp"
+
 /*
  Reverse group by group
  0. grouping via manual search + std::reverse. 0.68 GB/s.
@@ -23,7 +26,7 @@
  2. mmap instead new. 1.03 GB/s
     I/O time from 0.9s to 0.85s.
     Process time - 130ms (with ~8 GB/s) - on gcc. LLVM has problems with std::reverse
-    vectorization.
+    vectorization - std::reverse is simd_reverse now, same on both.
     Cost of 0.85s is high but mostly because of allocation lot of virtual memory
     (it takes ~0.2s). For now it's impossible to get rid if this cost.
  3. For now every byte is touched 4 times:
@@ -35,53 +38,63 @@
         real	0m0.975s
 */
 
-static inline uint64_t realtime_now() {
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    return ts.tv_sec * 1'000'000'000ULL + ts.tv_nsec;
-}
-
-static unsigned get_buffer_capacity() {
+static size_t get_buffer_capacity() {
     struct stat fileinfo;
     fstat(fileno(stdin), &fileinfo);
     return fileinfo.st_size;
 }
 
 static void process1(char *from, char *to) {
-    std::reverse(from, to);
+    revcomp::simd_reverse(from, to);
 }
 
-int main() {
+int main(int argc, char **argv) {
+    using revcomp::phase, revcomp::phase_scope;
+    revcomp::stats st{"rev2", argc, argv};
     const auto buffer_size = get_buffer_capacity();
     auto buffer = (char*) mmap (NULL, buffer_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     auto in = fileno(stdin);
 
-    auto t0 = realtime_now();
-    read(in, &buffer[0], buffer_size);
-    auto t1 = realtime_now();
-    printf("read time: %zu ms\n", (t1-t0)/1'000'000);
+    // one read()/write() moves at most ~2GB (0x7ffff000), bigger inputs need a loop
+    {
+        phase_scope scope{st, phase::read};
+        for (size_t done = 0; done < buffer_size;) {
+            auto bytes = read(in, &buffer[done], buffer_size - done);
+            if (bytes <= 0)
+                break;
+            st.syscall(phase::read, bytes);
+            done += bytes;
+        }
+    }
 
     buffer[buffer_size] = '>';
-    t0 = realtime_now();
 
-    auto last = buffer_size;
-    auto *from = &buffer[0], *to = &buffer[last];
-    while (from < &buffer[last]) {
-        from = (char*)memchr(from, '\n', &buffer[last] - from + 1) + 1;
-        to = (char*)memchr(from, '>', &buffer[last] - from + 1);
-        process1(from, to - 1);
-        from = to;
+    {
+        phase_scope scope{st, phase::transform};
+        auto last = buffer_size;
+        auto *from = &buffer[0], *to = &buffer[last];
+        while (from < &buffer[last]) {
+            from = (char*)memchr(from, '\n', &buffer[last] - from + 1) + 1;
+            to = (char*)memchr(from, '>', &buffer[last] - from + 1);
+            process1(from, to - 1);
+            from = to;
+            st.records++;
+        }
+        st.processed(phase::transform, buffer_size);
     }
 
-    t1 = realtime_now();
-    printf("process time: %zu ms\n", (t1-t0)/1'000'000);
-    t0 = realtime_now();
-
-    write(fileno(stdout), buffer, buffer_size);
-
-    t1 = realtime_now();
-    printf("write time: %zu ms\n", (t1-t0)/1'000'000);
+    {
+        phase_scope scope{st, phase::write};
+        for (size_t done = 0; done < buffer_size;) {
+            auto bytes = write(fileno(stdout), buffer + done, buffer_size - done);
+            if (bytes <= 0)
+                break;
+            st.syscall(phase::write, bytes);
+            done += bytes;
+        }
+    }
     munmap(buffer, buffer_size+1);
+    st.print_json(stderr);
     return 0;
 }
@@ -19,6 +19,8 @@
 #include <cassert>
 #include<sys/sendfile.h>
 
+#include "simd_reverse.hpp"
+
 /*
 Rust:
 
@@ -30,7 +32,7 @@ tac is ~1.5s but it just reverse line by line (first line become last)!
       Anyway interesting approach by seeking every 64k from end.
 */
 
-static unsigned get_file_size() {
+static size_t get_file_size() {
     struct stat fileinfo;
     fstat(fileno(stdin), &fileinfo);
     return fileinfo.st_size;
@@ -94,8 +96,13 @@ static unsigned get_file_size() {
 */
 int main00() {
     auto bytes = get_file_size();
-    auto written = sendfile(STDOUT_FILENO, STDIN_FILENO, 0, bytes);
-    assert(written == bytes);
+    // sendfile moves at most ~2GB (0x7ffff000) per call
+    size_t written = 0;
+    while (written < bytes) {
+        auto sent = sendfile(STDOUT_FILENO, STDIN_FILENO, 0, bytes - written);
+        assert(sent > 0);
+        written += sent;
+    }
     return 0;
 }
 
@@ -119,8 +126,8 @@ int main0() {
     auto buffer = (char*) mmap (NULL, buffer_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    size_t size = buffer_size;
-    while ((size = read(fileno(stdin), buffer, buffer_size)) != 0) {
+    ssize_t size;
+    while ((size = read(fileno(stdin), buffer, buffer_size)) > 0) {
         write(fileno(stdout), buffer, size);
     }
     munmap(buffer, buffer_size+1);
@@ -143,9 +150,9 @@ int main1() {
     auto buffer = (char*) mmap (NULL, alloc_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    size_t size = buffer_size;
+    ssize_t size;
     auto current = buffer;
-    while ((size = read(fileno(stdin), current, buffer_size)) != 0) {
+    while ((size = read(fileno(stdin), current, buffer_size)) > 0) {
         write(fileno(stdout), current, size);
         current += size;
         if ((current - buffer) + buffer_size >= alloc_size)
@@ -179,12 +186,12 @@ int main2() {
     auto buffer = (char*) mmap (NULL, alloc_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    auto size = buffer_size;
-    auto read_bytes = 0u, all = 0u, reverses = 0u;
-    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) != 0) {
+    ssize_t size;
+    size_t read_bytes = 0, all = 0, reverses = 0;
+    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) > 0) {
         read_bytes += size;
         if (read_bytes >= step || size < buffer_size) {
-            std::reverse(buffer, buffer + read_bytes);
+            revcomp::simd_reverse(buffer, buffer + read_bytes);
             write(fileno(stdout), buffer, read_bytes);
             all += read_bytes;
             read_bytes = 0;
@@ -192,7 +199,7 @@ int main2() {
         }
     }
     munmap(buffer, alloc_size+1);
-    printf("summary:    %u B    %u\n", all, reverses);
+    printf("summary:    %zu B    %zu\n", all, reverses);
     return 0;
 }
 
@@ -209,12 +216,12 @@ int main3() {
     auto buffer = (char*) mmap (NULL, alloc_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    auto size = buffer_size;
-    auto read_bytes = 0u, all = 0u, reverses = 0u;
-    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) != 0) {
+    ssize_t size;
+    size_t read_bytes = 0, all = 0, reverses = 0;
+    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) > 0) {
         read_bytes += size;
         if (read_bytes >= step || size < buffer_size) {
-            std::reverse(buffer, buffer + read_bytes);
+            revcomp::simd_reverse(buffer, buffer + read_bytes);
             write(fileno(stdout), buffer, read_bytes);
             all += read_bytes;
             read_bytes = 0;
@@ -222,7 +229,7 @@ int main3() {
         }
     }
     munmap(buffer, alloc_size+1);
-    printf("summary:    %u B    %u\n", all, reverses);
+    printf("summary:    %zu B    %zu\n", all, reverses);
     return 0;
 }
 
@@ -244,20 +251,20 @@ int main3() {
  */
 int main4() {
     constexpr auto buffer_size = 1u<<16u;
-    auto alloc_size = buffer_size<<1u;
-    constexpr auto max_alloc_size = (1<<29);
+    size_t alloc_size = buffer_size<<1u;
+    constexpr size_t max_alloc_size = 1<<29;
     constexpr auto step = (1<<28) + (1<<27) - buffer_size;
     auto buffer = (char*) mmap (NULL, alloc_size, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
 
     assert(buffer != MAP_FAILED);
-    auto size = buffer_size;
-    auto read_bytes = 0u, all = 0u, reverses = 0u;
-    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) != 0) {
+    ssize_t size;
+    size_t read_bytes = 0, all = 0, reverses = 0;
+    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) > 0) {
         read_bytes += size;
 
         if (read_bytes >= step || size < buffer_size) {
-            std::reverse(buffer, buffer + read_bytes);
+            revcomp::simd_reverse(buffer, buffer + read_bytes);
             write(fileno(stdout), buffer, read_bytes);
             all += read_bytes;
             read_bytes = 0;
@@ -265,7 +272,7 @@ int main4() {
         }
         if (read_bytes + buffer_size >= alloc_size) {
             auto old_alloc_size = alloc_size;
-            alloc_size = static_cast<int>(alloc_size * 2.0f);
+            alloc_size *= 2;
             buffer = (char*)mremap(buffer, old_alloc_size, alloc_size, MREMAP_MAYMOVE); //MREMAP_FIXED
             assert(buffer != MAP_FAILED );
             assert(alloc_size <= max_alloc_size);
@@ -289,7 +296,7 @@ int main5() {
     auto reverses = 0u;
     char *current = nullptr;
     while ((size = getdelim(&current, &buffer_size, '>', stdin)) > 0) {
-        std::reverse(current, current + size);
+        revcomp::simd_reverse(current, current + size);
         write(fileno(stdout), current, size);
         reverses++;
     }
@@ -318,18 +325,18 @@ int main5() {
  */
 int main6() {
     constexpr auto buffer_size = 1u<<16u;
-    auto alloc_size = 1u<<17u;
-    constexpr auto max_alloc_size = (1<<29);
+    size_t alloc_size = 1u<<17u;
+    constexpr size_t max_alloc_size = 1<<29;
     auto buffer = (char*) mmap (NULL, alloc_size, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
 
     assert(buffer != MAP_FAILED);
-    auto size = buffer_size;
-    auto read_bytes = 0u, all = 0u, reverses = 0u;
+    ssize_t size;
+    size_t read_bytes = 0, all = 0, reverses = 0;
     char *found = nullptr;
-    int first = -1, last = -1;
+    ssize_t first = -1, last = -1;
 
-    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) != 0) {
+    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) > 0) {
         found = (char*)memchr(buffer + read_bytes, '>', size);
         if (found) {
             if (first == -1)
@@ -348,7 +355,7 @@ int main6() {
         if ((first != -1 && last != -1) || size < buffer_size) {
             if (last == -1)
                 last = read_bytes;
-            std::reverse(buffer + first, buffer + last);
+            revcomp::simd_reverse(buffer + first, buffer + last);
             write(fileno(stdout), buffer + first, last - first);
             all += read_bytes;
             memmove(buffer, buffer + last, read_bytes - last);
@@ -359,7 +366,7 @@ int main6() {
 
         if (read_bytes + buffer_size >= alloc_size) {
             auto old_alloc_size = alloc_size;
-            alloc_size = static_cast<int>(alloc_size * 2.0f);
+            alloc_size *= 2;
             buffer = (char*)mremap(buffer, old_alloc_size, alloc_size, MREMAP_MAYMOVE); //MREMAP_FIXED
             assert(buffer != MAP_FAILED );
             assert(alloc_size <= max_alloc_size);
@@ -380,21 +387,21 @@ int main6() {
  */
 int main7() {
     constexpr auto buffer_size = 1u<<16u;
-    auto alloc_size = 1u<<17u;
-    constexpr auto max_alloc_size = (1<<29);
+    size_t alloc_size = 1u<<17u;
+    constexpr size_t max_alloc_size = 1<<29;
     auto buffer = (char*) mmap (NULL, alloc_size, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
 
     assert(buffer != MAP_FAILED);
-    auto size = buffer_size;
-    auto read_bytes = 0u, all = 0u, reverses = 0u;
+    ssize_t size;
+    size_t read_bytes = 0, all = 0, reverses = 0;
     char *found = nullptr;
-    int first = -1, last = -1;
+    ssize_t first = -1, last = -1;
 
     //int fd = open("insmall.txt",  O_RDONLY);
     //assert(fd != -1);
 
-    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) != 0) { //fd
+    while ((size = read(fileno(stdin), buffer + read_bytes, buffer_size)) > 0) { //fd
         found = (char*)memchr(buffer + read_bytes, '>', size);
         //if (found)
         //    printf("found= %lu\n", found - buffer);
@@ -421,7 +428,7 @@ int main7() {
             //printf("rev:  %d  %d\n", first, last);
             all += read_bytes;
             //printf("size=%u  rb=%u  memcpy= %u, all = %u\n", size, read_bytes,  read_bytes - last, all);
-            std::reverse(buffer + first, buffer + last);
+            revcomp::simd_reverse(buffer + first, buffer + last);
             write(fileno(stdout), buffer + first, last - first);
 
             memmove(buffer, buffer + last, read_bytes - last);
@@ -432,7 +439,7 @@ int main7() {
 
         if (read_bytes + buffer_size >= alloc_size) {
             auto old_alloc_size = alloc_size;
-            alloc_size = static_cast<int>(alloc_size * 2.0f);
+            alloc_size *= 2;
             //printf("alloc to %u\n", alloc_size);
             buffer = (char*)mremap(buffer, old_alloc_size, alloc_size, MREMAP_MAYMOVE); //MREMAP_FIXED
             assert(buffer != MAP_FAILED );
@@ -460,12 +467,12 @@ int main8() {
     auto buffer = (char*) mmap (NULL, buffer_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    size_t size = buffer_size;
-    auto all = 0u;
-    while ((size = read(fileno(stdin), buffer, buffer_size)) != 0) {
+    ssize_t size;
+    size_t all = 0;
+    while ((size = read(fileno(stdin), buffer, buffer_size)) > 0) {
        auto found = (char*)memchr(buffer, '>', size);
        if (found)
-           printf("pos = %u\n", all + unsigned(found - buffer));
+           printf("pos = %zu\n", all + size_t(found - buffer));
        all += size;
     }
     munmap(buffer, buffer_size+1);
@@ -484,15 +491,13 @@ int main9() {
     auto buffer = (char*) mmap (NULL, buffer_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    size_t size = buffer_size;
-    off_t start_from = get_file_size() - buffer_size;
-    while ((size = pread(fileno(stdin), buffer, buffer_size, start_from))) {
+    ssize_t size;
+    off_t start_from = off_t(get_file_size()) - buffer_size;
+    while ((size = pread(fileno(stdin), buffer, buffer_size, start_from)) > 0) {
        auto found = (char*)memchr(buffer, '>', size);
        if (found)
-           printf("pos = %u\n", unsigned(start_from) + unsigned(found - buffer));
+           printf("pos = %zu\n", size_t(start_from) + size_t(found - buffer));
        start_from -= size;
-       if (size == (size_t)-1)
-           break;
     }
     munmap(buffer, buffer_size+1);
     return 0;
@@ -513,10 +518,10 @@ int main10() {
     auto buffer = (char*) mmap (NULL, buffer_size+1, PROT_READ|PROT_WRITE,
              MAP_PRIVATE|MAP_POPULATE|MAP_ANONYMOUS, -1, 0);
     assert(buffer != MAP_FAILED);
-    size_t size = buffer_size;
-    auto read_bytes = 0u, reverses = 0u;
-    int first = -1, last = -1;
-    while ((size = read(fileno(stdin), buffer, buffer_size)) != 0) {
+    ssize_t size;
+    size_t read_bytes = 0, reverses = 0;
+    off_t first = -1, last = -1;
+    while ((size = read(fileno(stdin), buffer, buffer_size)) > 0) {
        auto found = (char*)memchr(buffer, '>', size);
        if (found) {
            if (first == -1)
@@ -534,11 +539,11 @@ int main10() {
 
            off_t start_from = last - buffer_size;
            write(fileno(stdout), ">>\n", 3);
-           while ((size = pread(fileno(stdin), buffer, buffer_size, start_from))) {
-              std::reverse(buffer, buffer + size);
+           while ((size = pread(fileno(stdin), buffer, buffer_size, start_from)) > 0) {
+              revcomp::simd_reverse(buffer, buffer + size);
               write(fileno(stdout), buffer,  size);
               start_from -= size;
-              if (start_from <= first || size == (size_t)-1)
+              if (start_from <= first)
                   break;
            }
            reverses++;
@@ -331,7 +331,7 @@ bool scalar_in_set2(uint8_t bitmap_0_7[16], uint8_t bitmap_8_15[16], uint8_t byt
 
 // check 16 byte items at once
 void vector_in_set(uint8_t *ptr) {
-    const __m128i input = _mm_loadu_si128(ptr);
+    const __m128i input = _mm_loadu_si128((const __m128i*)ptr);
     const __m128i lower_nibbles = _mm_and_si128(input, _mm_set1_epi8(0x0f));
     const __m128i higher_nibbles = _mm_and_si128(_mm_srli_epi16(input, 4), _mm_set1_epi8(0x0f));
 
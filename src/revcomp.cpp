@@ -0,0 +1,294 @@
+/*
+  revcomp - one binary for all strategies from main.cpp, rev1..rev3 and cpp-7.
+
+  Engines (--engine=):
+    memory  - input mapped as a whole, regular file which fits in RAM     (rev2)
+    pread   - index + backward pread windows, bounded memory, seekable    (cpp-7, main10)
+    stream  - chunked read with growing buffer, works on pipes            (main.cpp, main6)
+    pipeline - stream split into reader, transform and writer threads, for pipes
+    auto    - default, picks one of above from fstat of stdin/stdout and available memory
+
+  All engines share transform (fasta.hpp) and output coalescing (output.hpp), so
+  output is byte-identical whichever is used.
+
+  Block and buffer sizes come from config written by --calibrate (tuning.hpp).
+  Memory engine transforms in parallel on big inputs, workers are placed by
+  topology.hpp. Regular file on stdout is filled through a shared mapping when
+  input size is known (mapped_output.hpp), or with O_DIRECT past page cache by
+  --output=direct (direct_output.hpp). --validate checks the alphabet and
+  --stats-per-record counts bases in the transform pass (validate.hpp, record_stats.hpp),
+  --checksums and --verify take CRC32C of output as it's produced (checksum.hpp).
+  --max-memory keeps every engine within a budget (memory_budget.hpp).
+  --batch does a list of files on one work-stealing pool (batch.hpp).
+  --kmers writes canonical k-mers instead of reverse-complement (kmers.hpp).
+  --search finds patterns on both strands in one forward pass (search.hpp).
+*/
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alphabet.hpp"
+#include "batch.hpp"
+#include "calibrate.hpp"
+#include "engine_memory.hpp"
+#include "engine_pipeline.hpp"
+#include "engine_pread.hpp"
+#include "engine_stream.hpp"
+#include "kmers.hpp"
+#include "memory_budget.hpp"
+#include "options.hpp"
+#include "search.hpp"
+#include "stats.hpp"
+
+namespace revcomp {
+
+// MemAvailable from /proc/meminfo, it counts reclaimable page cache unlike _SC_AVPHYS_PAGES
+static size_t available_memory() {
+    std::ifstream meminfo("/proc/meminfo");
+    std::string key;
+    size_t kb;
+    while (meminfo >> key >> kb) {
+        if (key == "MemAvailable:")
+            return kb * 1024;
+        meminfo.ignore(64, '\n');
+    }
+    return size_t(sysconf(_SC_AVPHYS_PAGES)) * size_t(sysconf(_SC_PAGESIZE));
+}
+
+/*
+  auto:
+    - stdin is not a regular file (pipe, socket, tty)      -> pipeline with 3+ cpus,
+                                                              stream otherwise
+    - regular file and it fits in half of available memory -> memory
+      (and in a quarter of --max-memory)
+    - otherwise                                            -> pread
+  Mapping the input uses page cache, half of MemAvailable leaves room for output
+  and other tenants. Pipe on stdout gets 1MB capacity so our 4MB flushes need fewer
+  wakeups of the reader.
+*/
+static std::string select_engine(const options &opts, const struct stat &in, const struct stat &out,
+                                 int out_fd) {
+    auto regular = S_ISREG(in.st_mode);
+    if (regular && S_ISREG(out.st_mode) && in.st_dev == out.st_dev && in.st_ino == out.st_ino)
+        throw std::runtime_error("input and output are the same file");
+
+    if (opts.engine != "auto") {
+        if (opts.engine != "memory" && opts.engine != "pread" && opts.engine != "stream" &&
+            opts.engine != "pipeline")
+            throw std::invalid_argument("unknown engine " + opts.engine);
+        if (opts.engine != "stream" && opts.engine != "pipeline" && !regular)
+            throw std::invalid_argument(opts.engine + " engine needs a regular file on stdin");
+        if (opts.engine == "memory" && opts.max_memory && size_t(in.st_size) > in_memory_limit(opts.max_memory))
+            throw std::invalid_argument("memory engine needs input under a quarter of --max-memory, pread fits");
+        return opts.engine;
+    }
+
+    if (S_ISFIFO(out.st_mode))
+        fcntl(out_fd, F_SETPIPE_SZ, 1 << 20);
+
+    if (!regular)
+        return topology::host().default_threads() >= 3 ? "pipeline" : "stream";
+    auto limit = available_memory() / 2;
+    if (opts.max_memory)
+        limit = std::min(limit, in_memory_limit(opts.max_memory));
+    return size_t(in.st_size) <= limit ? "memory" : "pread";
+}
+
+static int run_calibrate(const options &opts) {
+    auto path = std::filesystem::path(opts.config.empty() ? default_config_path() : opts.config);
+    auto kept = load_tuning(path);     // stream_above is not measured, saved as it was
+    auto tune = calibrate(stderr);
+    tune.stream_above = kept.stream_above;
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path());
+    save_tuning(path, tune, host_caches());
+    fprintf(stderr, "saved to %s\n", path.c_str());
+    return 0;
+}
+
+static void load_complement(const options &opts) {
+    active_table() = load_alphabet(opts.alphabet);
+    if (!opts.validate.empty() && opts.validate != "fail" && opts.validate != "warn")
+        throw std::invalid_argument("unknown validate mode " + opts.validate);
+    invalid_policy() = opts.validate == "warn" ? on_invalid::warn : on_invalid::fail;
+}
+
+static int run_batch_list(const options &opts) {
+    if (opts.engine != "auto" || opts.output != "auto" || !opts.checksums.empty() || !opts.verify.empty() ||
+        !opts.record_stats.empty())
+        throw std::invalid_argument("--batch takes no --engine, --output, --checksums, --verify or --stats-per-record");
+    load_complement(opts);
+    auto tune = load_tuning(opts.config.empty() ? default_config_path() : opts.config);
+    auto files = read_batch_list(opts.batch);
+    auto threads = std::max<size_t>(opts.threads ? opts.threads : topology::host().default_threads(), 1);
+    if (opts.max_memory)
+        fit_to_budget(tune, "memory", threads, opts.max_memory);
+    stats st{"batch", opts.stats};
+    if (opts.perf)
+        st.enable_perf();
+
+    with_kernel(opts.kernel, [&]<class K>() {
+        if (opts.validate.empty())
+            run_batch<K>(files, tune, threads, st);
+        else
+            run_batch<with_extras<K, check_alphabet>>(files, tune, threads, st);
+    });
+    st.print_json(stderr);
+    return 0;
+}
+
+static int run_kmer_mode(const options &opts, int in, int out) {
+    if (opts.engine != "auto" || opts.output != "auto" || !opts.validate.empty() || !opts.checksums.empty() ||
+        !opts.verify.empty() || !opts.record_stats.empty() || !opts.batch.empty() || opts.alphabet != "dna")
+        throw std::invalid_argument("--kmers takes no --engine, --output, --validate, --checksums, --verify, "
+                                    "--stats-per-record, --batch or --alphabet");
+    auto tune = load_tuning(opts.config.empty() ? default_config_path() : opts.config);
+    if (opts.max_memory)
+        fit_to_budget(tune, "stream", 1, opts.max_memory);
+    stats st{"kmers", opts.stats};
+    if (opts.perf)
+        st.enable_perf();
+    output_buffer buf{out, st, tune.write_batch};
+    run_kmers(in, buf, opts.kmers, opts.kmer_hash, tune, st);
+    st.print_json(stderr);
+    return 0;
+}
+
+static int run_search_mode(const options &opts, int in, int out) {
+    if (opts.engine != "auto" || opts.output != "auto" || !opts.validate.empty() || !opts.checksums.empty() ||
+        !opts.verify.empty() || !opts.record_stats.empty() || !opts.batch.empty() || opts.kmers ||
+        opts.alphabet != "dna")
+        throw std::invalid_argument("--search takes no --engine, --output, --validate, --checksums, --verify, "
+                                    "--stats-per-record, --batch, --kmers or --alphabet");
+    pattern_set patterns{opts.search};
+    auto tune = load_tuning(opts.config.empty() ? default_config_path() : opts.config);
+    if (opts.max_memory)
+        fit_to_budget(tune, "stream", 1, opts.max_memory);
+    stats st{"search", opts.stats};
+    if (opts.perf)
+        st.enable_perf();
+    output_buffer buf{out, st, tune.write_batch};
+    run_search(in, buf, patterns, tune, st);
+    st.print_json(stderr);
+    return 0;
+}
+
+static int run(const options &opts, int in, int out) {
+    if (opts.calibrate)
+        return run_calibrate(opts);
+    if (!opts.search.empty())
+        return run_search_mode(opts, in, out);
+    if (opts.kmers)
+        return run_kmer_mode(opts, in, out);
+    if (opts.kmer_hash)
+        throw std::invalid_argument("--kmer-hash needs --kmers");
+    if (!opts.batch.empty())
+        return run_batch_list(opts);
+
+    struct stat in_stat, out_stat;
+    if (fstat(in, &in_stat) || fstat(out, &out_stat))
+        throw std::system_error(errno, std::generic_category(), "fstat");
+
+    load_complement(opts);
+    auto tune = load_tuning(opts.config.empty() ? default_config_path() : opts.config);
+    auto engine = select_engine(opts, in_stat, out_stat, out);
+    stats st{engine.c_str(), opts.stats};
+    if (opts.perf)
+        st.enable_perf();
+
+    size_t threads = 1;
+    if (engine == "memory") {
+        threads = opts.threads;
+        if (!threads)
+            threads = std::min(topology::host().default_threads(),
+                               size_t(in_stat.st_size) / tune.write_batch / 2);
+        threads = std::max<size_t>(threads, 1);
+    } else if (engine == "pipeline") {
+        // reader and writer have own threads, one transform thread keeps up with most pipes
+        threads = std::max<size_t>(opts.threads ? opts.threads : 1, 1);
+    }
+
+    if (opts.max_memory)
+        tune.spill_above = fit_to_budget(tune, engine, threads, opts.max_memory, opts.output == "direct" ? 2 : 0);
+
+    if (opts.output != "auto" && opts.output != "write" && opts.output != "map" && opts.output != "direct")
+        throw std::invalid_argument("unknown output mode " + opts.output);
+    if (opts.drop_input_cache && opts.output != "direct")
+        throw std::invalid_argument("--drop-input-cache needs --output=direct");
+    // auto maps only outputs bigger than LLC, below it write() copy is cheap and stays cached
+    output_buffer buf{out, st, tune.write_batch};
+    std::unique_ptr<direct_output> direct;
+    if (opts.output == "direct") {
+        direct = direct_output::open(out, tune.write_batch, opts.drop_input_cache ? in : -1, st);
+        if (!direct)
+            throw std::invalid_argument("--output=direct needs regular file on stdout at offset 0, "
+                                        "on a filesystem with O_DIRECT");
+        buf.direct_to(*direct);
+    }
+    std::unique_ptr<output_map> mapped;
+    auto llc = host_caches().l3;
+    auto want_map = opts.output == "map" || (opts.output == "auto" && size_t(in_stat.st_size) > llc);
+    if (engine != "stream" && engine != "pipeline" && want_map)
+        mapped = output_map::open(out, in_stat.st_size, out_stat);
+    if (opts.output == "map" && !mapped && in_stat.st_size > 0)
+        throw std::invalid_argument("--output=map needs regular file on stdout at offset 0 and on stdin");
+    if (mapped)
+        buf.map_to(*mapped, tune.stream_above ? tune.stream_above : llc, tune.tile);
+    std::unique_ptr<output_checksums> sums;
+    if (!opts.checksums.empty() || !opts.verify.empty())
+        buf.checksum_to(*(sums = std::make_unique<output_checksums>(opts.checksums, opts.verify)));
+
+    auto run_engine = [&]<class K>() {
+        if (engine == "memory")
+            run_memory<K>(in, buf, in_stat.st_size, tune, st, threads);
+        else if (engine == "pread")
+            run_pread<K>(in, buf, in_stat.st_size, tune, st);
+        else if (engine == "pipeline")
+            run_pipeline<K>(in, buf, tune, st, threads);
+        else
+            run_stream<K>(in, buf, tune, st);
+    };
+    // every combination of extras is its own instantiation, so plain runs pay nothing
+    std::unique_ptr<record_table> table;
+    if (!opts.record_stats.empty())
+        record_stats_table() = (table = std::make_unique<record_table>(opts.record_stats)).get();
+    unsigned extras = (opts.validate.empty() ? 0u : check_alphabet) | (table ? count_bases : 0u);
+    with_kernel(opts.kernel, [&]<class K>() {
+        if (extras == 0)
+            run_engine.template operator()<K>();
+        else if (extras == check_alphabet)
+            run_engine.template operator()<with_extras<K, check_alphabet>>();
+        else if (extras == count_bases)
+            run_engine.template operator()<with_extras<K, count_bases>>();
+        else
+            run_engine.template operator()<with_extras<K, check_alphabet | count_bases>>();
+    });
+    if (direct)
+        direct->finish();
+    if (table)
+        table->close();
+    if (sums)
+        sums->finish();
+
+    st.print_json(stderr);
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+    try {
+        auto opts = revcomp::parse_options(argc, argv);
+        if (opts.help) {
+            fputs(revcomp::usage, stdout);
+            return 0;
+        }
+        return revcomp::run(opts, STDIN_FILENO, STDOUT_FILENO);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "revcomp: %s\n", e.what());
+        return 1;
+    }
+}
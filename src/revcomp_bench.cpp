@@ -0,0 +1,390 @@
+/*
+  revcomp_bench - every engine x complement kernel on the same input.
+
+  usage: revcomp_bench [size_mb=64] [repeats=3]
+         revcomp_bench --large[=GB] [dir]
+         revcomp_bench --check
+
+  Input is synthetic FASTA in memfd (calibrate.hpp) - once plain ACGT and once with
+  soft-masked (lowercase) and ambiguity residues, which is what takes swar64 off its fast
+  path. Output goes to memfd, so numbers are CPU + page cache, no disk. Every point is
+  best of `repeats`, output of every pair is compared with the first one.
+
+  Pick the pairing for a deployment from the table and pass it as
+  revcomp --engine= --kernel=.
+
+  --large (default 5GB) checks 64-bit offsets: input is an unnamed file in dir
+  (default /tmp, O_TMPFILE) - 64MB synthetic unit, one record whose body is a single
+  line up to size (a hole, so it costs no disk writes) and the unit again past the
+  4GB offset. pread engine (memory is batch + window, not input size) writes it to
+  /dev/null with --checksums' CRC32C, which must equal CRC32C of the expected output
+  built from the transformed unit and complement of the fill byte. The same is run at
+  1/8 of the size, GB/s of the two must be close - truncated or wrapped offsets show
+  as a checksum mismatch, a cliff as lower GB/s of the big one. 5GB in /dev/shm:
+  2.75GB/s, 140MB max RSS; on a disk whose holes read slowly it measures the disk.
+
+  --check runs inputs which broke engines before - ragged and blank lines, empty
+  records, no trailing newline - through every engine x kernel, to write() and to a
+  mapping, with default and with tiny buffers (windows, pieces and batches of a few
+  bytes). Output must be the expected bytes, or for the generated mix the bytes of
+  stream engine; exit status 1 otherwise. --kmers output of inputs with headers and
+  empty records where the output buffer is full is compared with k-mers computed
+  position by position.
+*/
+#include <cstdio>
+#include <fcntl.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "calibrate.hpp"
+#include "engine_memory.hpp"
+#include "engine_pipeline.hpp"
+#include "engine_pread.hpp"
+#include "engine_stream.hpp"
+#include "kernels.hpp"
+#include "kmers.hpp"
+
+namespace revcomp {
+
+static std::string read_back(int fd) {
+    std::string data(lseek(fd, 0, SEEK_END), '\0');
+    stats quiet{"bench"};
+    pread_full(fd, data.data(), data.size(), 0, quiet);
+    return data;
+}
+
+// reverse-complement of text, through memory engine
+static std::string transformed(const std::string &text) {
+    memfd input{"revcomp-bench-in"}, output{"revcomp-bench-out"};
+    stats quiet{"bench"};
+    write_all(input.fd, text.data(), text.size(), quiet);
+    output_buffer ob{output.fd, quiet};
+    run_memory(input.fd, ob, text.size(), tuning{}, quiet);
+    return read_back(output.fd);
+}
+
+// synthetic unit, one record of a single line of `fill` bytes up to size, unit again
+struct large_input {
+    explicit large_input(size_t size)
+        : line(size - std::min(size, 2 * unit.size() + header.size() + 1)) {}
+
+    // text in order, the line in pieces of up to 1MB
+    template <class Piece>
+    void each(const std::string &unit_text, char fill, Piece piece) const {
+        piece(unit_text);
+        piece(header);
+        std::string run(1 << 20, fill);
+        for (size_t i = 0; i < line; i += run.size())
+            piece(std::string_view{run}.substr(0, std::min(run.size(), line - i)));
+        piece("\n");
+        piece(unit_text);
+    }
+
+    size_t bytes() const { return 2 * unit.size() + header.size() + line + 1; }
+
+    inline static const std::string unit = synthetic_fasta(64 << 20);
+    inline static const std::string header = ">large record crossing 4GB\n";
+    size_t line;
+};
+
+static int bench_large(size_t size, const char *dir) {
+    auto unit_out = transformed(large_input::unit);
+    auto fill_out = transformed(large_input::header + std::string(4096, '\0') + "\n")[large_input::header.size()];
+    auto null = open("/dev/null", O_WRONLY);
+    if (null == -1)
+        throw std::system_error(errno, std::generic_category(), "/dev/null");
+    tuning tune;
+    bool ok = true;
+
+    printf("%-8s%12s%12s%10s%12s  %s\n", "", "input", "output", "GB/s", "max RSS", "crc32c");
+    for (auto bytes : {size / 8, size}) {
+        large_input in{bytes};
+        output_checksums want{"", ""};
+        in.each(unit_out, fill_out, [&](std::string_view s) { want.add(s.data(), s.size()); });
+
+        // the line is a hole, only the units and its ends are written
+        auto fd = open(dir, O_TMPFILE | O_RDWR, 0600);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), dir);
+        stats quiet{"bench"};
+        size_t off = 0;
+        in.each(large_input::unit, '\0', [&](std::string_view s) {
+            if (s.find_first_not_of('\0') != s.npos && pwrite(fd, s.data(), s.size(), off_t(off)) != ssize_t(s.size()))
+                throw std::system_error(errno, std::generic_category(), "pwrite");
+            off += s.size();
+        });
+
+        output_checksums got{"", ""};
+        output_buffer ob{null, quiet, tune.write_batch};
+        ob.checksum_to(got);
+        auto t0 = monotonic_now();
+        run_pread(fd, ob, in.bytes(), tune, quiet);
+        auto ns = monotonic_now() - t0;
+        close(fd);
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        auto match = got.bytes() == want.bytes() && got.crc() == want.crc();
+        ok &= match;
+        printf("%-8s%10.2fGB%10.2fGB%10.2f%10ldMB  %08x %s\n", "pread", double(in.bytes()) / (1 << 30),
+               double(got.bytes()) / (1 << 30), double(in.bytes()) / double(ns), usage.ru_maxrss >> 10,
+               got.crc(), match ? "ok" : "MISMATCH");
+        fflush(stdout);
+    }
+    close(null);
+    return ok ? 0 : 1;
+}
+
+// output of engine with kernel K, threads for memory engine; map - to a mapping instead of write()
+template <class K>
+static std::string run_engine(std::string_view engine, const std::string &text, const tuning &tune,
+                              size_t threads, bool map) {
+    memfd input{"revcomp-check-in"}, output{"revcomp-check-out"};
+    stats quiet{"bench"};
+    write_all(input.fd, text.data(), text.size(), quiet);
+    if (lseek(input.fd, 0, SEEK_SET))
+        throw std::system_error(errno, std::generic_category(), "lseek");
+    struct stat out_stat;
+    if (fstat(output.fd, &out_stat))
+        throw std::system_error(errno, std::generic_category(), "fstat");
+    {
+        output_buffer ob{output.fd, quiet, tune.write_batch};
+        auto mapped = map ? output_map::open(output.fd, text.size(), out_stat) : nullptr;
+        if (mapped)
+            ob.map_to(*mapped, tune.tile, tune.tile);
+        if (engine == "memory")
+            run_memory<K>(input.fd, ob, text.size(), tune, quiet, threads);
+        else if (engine == "pread")
+            run_pread<K>(input.fd, ob, text.size(), tune, quiet);
+        else if (engine == "stream")
+            run_stream<K>(input.fd, ob, tune, quiet);
+        else
+            run_pipeline<K>(input.fd, ob, tune, quiet, threads);
+    }
+    return read_back(output.fd);
+}
+
+// records of every shape, a third of them ragged, some bigger than tiny buffers
+static std::string mixed_fasta(size_t records) {
+    std::string data = "text before the first record\n";
+    uint64_t x = 88172645463325252ULL;
+    auto next = [&] {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        return x;
+    };
+    for (size_t r = 0; r < records; r++) {
+        data += ">mixed " + std::to_string(r) + "\n";
+        auto n = next() % (r % 8 == 0 ? 20000 : 300);
+        auto width = 1 + next() % 80;
+        auto ragged = r % 3 == 0;
+        for (size_t i = 0, column = 0; i < n; i++) {
+            data += "ACGTNacgt"[next() % 9];
+            if (++column < width && i + 1 < n)
+                continue;
+            data += '\n';
+            column = 0;
+            if (ragged) {
+                width = 1 + next() % 80;
+                if (next() % 16 == 0)
+                    data += '\n';
+            }
+        }
+    }
+    return data;
+}
+
+static int check_edges() {
+    struct edge {
+        const char *name;
+        std::string input, expected;    // empty expected - same as stream engine
+    } edges[] = {
+        {"ragged lines", ">a\nAAAAC\nGGGT\nTTTTA\n", ">a\nTAAAA\nACCCG\nTTTT\n"},
+        {"blank lines", ">a\nAC\n\nGT\n>b\nACGT\nACGT\n\n", ">a\nAC\nGT\n>b\nACGT\nACGT\n"},
+        {"blank first line", ">c\n\nACGT\n", ">c\nA\nC\nG\nT\n"},
+        {"empty records", ">d\n\n>e\n>f\nACGT\n", ">d\n\n>e\n>f\nACGT\n"},
+        {"longer lines later", ">g\nACG\nACGTACGTAC\nA\n", ">g\nTGT\nACG\nTAC\nGTC\nGT\n"},
+        {"no trailing newline", ">h\nACGT\nAC", ">h\nGTAC\nGT"},
+        {"text before, ragged", "text\n>i x\nAA\nC\n", "text\n>i x\nGT\nT\n"},
+        {"generated mix", mixed_fasta(600), ""},
+    };
+    tuning tiny;
+    tiny.read_chunk = 100;
+    tiny.index_block = 50;
+    tiny.tile = 70;
+    tiny.write_batch = 64;
+    struct setup {
+        const char *name;
+        tuning tune;
+        size_t threads;
+    } setups[] = {{"default", tuning{}, 1}, {"tiny", tiny, 1}, {"tiny x3", tiny, 3}};
+    const char *engines[] = {"memory", "pread", "stream", "pipeline"};
+
+    bool ok = true;
+    for (auto &e : edges) {
+        auto expected = e.expected.empty() ? run_engine<default_kernel>("stream", e.input, tuning{}, 1, false)
+                                           : e.expected;
+        size_t runs = 0, failed = 0;
+        for_each_kernel([&]<class K>() {
+            for (auto &s : setups) {
+                for (std::string_view engine : engines) {
+                    for (auto map : {false, true}) {
+                        if (map && (engine == "stream" || engine == "pipeline"))
+                            continue;
+                        runs++;
+                        if (run_engine<K>(engine, e.input, s.tune, s.threads, map) == expected)
+                            continue;
+                        if (failed++ < 5)
+                            printf("  DIFF %s: %s engine, %s kernel, %s buffers, %s\n", e.name, engine.data(),
+                                   K::name, s.name, map ? "map" : "write");
+                    }
+                }
+            }
+        });
+        printf("%-22s%4zu runs  %s\n", e.name, runs, failed ? "FAIL" : "ok");
+        fflush(stdout);
+        ok &= failed == 0;
+    }
+    return ok ? 0 : 1;
+}
+
+// canonical k-mers of every record, one window at a time
+static std::vector<uint64_t> naive_kmers(const std::string &text, unsigned k) {
+    std::vector<uint64_t> kmers;
+    std::vector<uint8_t> codes;
+    auto take = [&] {
+        for (size_t i = 0; i + k <= codes.size(); i++) {
+            uint64_t fwd = 0, rev = 0;
+            bool bases = true;
+            for (size_t j = 0; j < k; j++) {
+                bases &= codes[i + j] < not_base;
+                fwd = fwd << 2 | (codes[i + j] & 3);
+                rev = rev << 2 | (3 - (codes[i + k - 1 - j] & 3));
+            }
+            if (bases)
+                kmers.push_back(std::min(fwd, rev));
+        }
+        codes.clear();
+    };
+    bool header = false;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '>' && (i == 0 || text[i - 1] == '\n')) {
+            take();
+            header = true;
+        } else if (header) {
+            header = text[i] != '\n';
+        } else if (auto c = base_codes[uint8_t(text[i])]; c != skipped) {
+            codes.push_back(c);
+        }
+    }
+    take();
+    return kmers;
+}
+
+static int check_kmers() {
+    // 2^19 k-mers of K=2 fill the default 4MB batch, the headers after it emit nothing
+    auto full = ">a\n" + std::string(524289, 'A') + "\n>b\n>c\nACGT\n";
+    std::string inputs[] = {full, full + ">d\n\n>e\n", ">x\n>y\nAC\nNGT\n>z\n", mixed_fasta(200)};
+    tuning tiny;
+    tiny.read_chunk = 100;
+    tiny.write_batch = 64;
+    size_t runs = 0, failed = 0;
+    for (auto &text : inputs) {
+        for (unsigned k : {1u, 2u, 31u}) {
+            auto expected = naive_kmers(text, k);
+            for (auto &tune : {tuning{}, tiny}) {
+                memfd input{"revcomp-check-in"}, output{"revcomp-check-out"};
+                stats quiet{"bench"};
+                write_all(input.fd, text.data(), text.size(), quiet);
+                if (lseek(input.fd, 0, SEEK_SET))
+                    throw std::system_error(errno, std::generic_category(), "lseek");
+                {
+                    output_buffer ob{output.fd, quiet, tune.write_batch};
+                    run_kmers(input.fd, ob, k, false, tune, quiet);
+                }
+                auto out = read_back(output.fd);
+                runs++;
+                auto same = out.size() == expected.size() * 8 &&
+                            (out.empty() || !memcmp(out.data(), expected.data(), out.size()));
+                if (same)
+                    continue;
+                if (failed++ < 5)
+                    printf("  DIFF kmers K=%u of %zu byte input, write_batch %zu\n", k, text.size(),
+                           tune.write_batch);
+            }
+        }
+    }
+    printf("%-22s%4zu runs  %s\n", "kmers", runs, failed ? "FAIL" : "ok");
+    return failed ? 1 : 0;
+}
+
+static int bench(size_t size, int repeats) {
+    const char *engines[] = {"memory", "pread", "stream", "pipeline"};
+    struct input {
+        const char *name;
+        const char *alphabet;
+    } inputs[] = {{"ACGT", "ACGT"}, {"mixed", "ACGTACGTacgtacgtNNRYKMSW"}};
+    tuning tune;
+
+    for (auto &in : inputs) {
+        memfd input{"revcomp-bench-in"}, output{"revcomp-bench-out"};
+        auto data = synthetic_fasta(size, in.alphabet);
+        stats quiet{"bench"};
+        write_all(input.fd, data.data(), data.size(), quiet);
+
+        printf("\n%s input, %zu MB, GB/s (best of %d)\n%-8s", in.name, data.size() >> 20, repeats, "");
+        for (auto engine : engines)
+            printf("%10s", engine);
+        printf("\n");
+
+        std::string expected;
+        for_each_kernel([&]<class K>() {
+            printf("%-8s", K::name);
+            for (std::string_view engine : engines) {
+                uint64_t best = ~0ULL;
+                for (int i = 0; i < repeats; i++) {
+                    if (ftruncate(output.fd, 0) || lseek(output.fd, 0, SEEK_SET) || lseek(input.fd, 0, SEEK_SET))
+                        throw std::system_error(errno, std::generic_category(), "ftruncate");
+                    output_buffer ob{output.fd, quiet, tune.write_batch};
+                    auto t0 = monotonic_now();
+                    if (engine == "memory")
+                        run_memory<K>(input.fd, ob, data.size(), tune, quiet);
+                    else if (engine == "pread")
+                        run_pread<K>(input.fd, ob, data.size(), tune, quiet);
+                    else if (engine == "stream")
+                        run_stream<K>(input.fd, ob, tune, quiet);
+                    else
+                        run_pipeline<K>(input.fd, ob, tune, quiet);
+                    best = std::min(best, monotonic_now() - t0);
+                }
+                auto out = read_back(output.fd);
+                if (expected.empty())
+                    expected = out;
+                printf("%10.2f%s", double(data.size()) / double(best), out == expected ? "" : " DIFF");
+            }
+            printf("\n");
+            fflush(stdout);
+        });
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+    try {
+        std::string_view first = argc > 1 ? argv[1] : "";
+        if (first == "--check")
+            return revcomp::check_edges() | revcomp::check_kmers();
+        if (first.starts_with("--large")) {
+            size_t gb = first.size() > 8 ? std::stoul(std::string(first.substr(8))) : 5;
+            return revcomp::bench_large(gb << 30, argc > 2 ? argv[2] : "/tmp");
+        }
+        size_t size_mb = argc > 1 ? std::stoul(argv[1]) : 64;
+        int repeats = argc > 2 ? std::stoi(argv[2]) : 3;
+        return revcomp::bench(size_mb << 20, repeats);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "revcomp_bench: %s\n", e.what());
+        return 1;
+    }
+}
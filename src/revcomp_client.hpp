@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+#include "daemon_protocol.hpp"
+
+/*
+  Client of revcompd (daemon_protocol.hpp).
+
+    revcomp_client c{"/run/revcompd.sock"};
+    auto rc = c.get("hg38", "chr1", 1000000, 1000100);   // 100 residues
+
+  get() is one round trip. For many regions queue() them and wait() for all, they go
+  out in one write and come back in order - the server answers what it read at once
+  as a batch, so latency of a round trip is shared by all of them.
+*/
+
+namespace revcomp {
+
+class revcomp_client {
+public:
+    struct reply {
+        uint32_t id;
+        reply_status status;
+        std::string data;   // residues, or error message
+    };
+
+    explicit revcomp_client(const std::string &path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof addr.sun_path)
+            throw std::invalid_argument("socket path too long: " + path);
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), "socket");
+        if (connect(fd, (const sockaddr*)&addr, sizeof addr)) {
+            auto err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+    }
+    revcomp_client(const revcomp_client&) = delete;
+    revcomp_client& operator=(const revcomp_client&) = delete;
+    ~revcomp_client() { close(fd); }
+
+    // reverse-complement of residues [start, end) of sequence in reference, throws on error
+    std::string get(std::string_view reference, std::string_view sequence, uint64_t start, uint64_t end) {
+        queue(reference, sequence, start, end);
+        wait(replies);
+        auto &r = replies.front();
+        if (r.status != reply_status::ok)
+            throw std::runtime_error(r.data);
+        return std::move(r.data);
+    }
+
+    // request to send with next wait(), returns its id
+    uint32_t queue(std::string_view reference, std::string_view sequence, uint64_t start, uint64_t end) {
+        encode_request(out, {next_id, start, end, reference, sequence});
+        pending++;
+        return next_id++;
+    }
+
+    /*
+      Send queued requests, replies to all of them in order. Replies are read while
+      requests are still going out, otherwise both sides could block in send() with
+      full socket buffers.
+    */
+    void wait(std::vector<reply> &got) {
+        got.resize(pending);
+        size_t sent = 0, done = 0, used = 0;
+        while (done < got.size()) {
+            pollfd p{fd, short(POLLIN | (sent < out.size() ? POLLOUT : 0)), 0};
+            if (poll(&p, 1, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "poll");
+            }
+            if (p.revents & POLLOUT) {
+                auto bytes = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+                    throw std::system_error(errno, std::generic_category(), "revcompd send");
+                sent += std::max<ssize_t>(bytes, 0);
+            }
+            if (!(p.revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            if (in.size() - used < (64 << 10))
+                in.resize(std::max(in.size() * 2, used + (64 << 10)));
+            auto bytes = recv(fd, in.data() + used, in.size() - used, MSG_DONTWAIT);
+            if (bytes == 0)
+                throw std::runtime_error("revcompd closed connection");
+            if (bytes < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "revcompd recv");
+            }
+            used += bytes;
+            size_t pos = 0;
+            while (done < got.size() && used - pos >= response_head) {
+                auto size = load_le<uint32_t>(in.data() + pos);
+                if (size < response_head - 4 || size > response_head - 4 + max_region)
+                    throw std::runtime_error("revcompd: bad response size");
+                if (used - pos < 4 + size)
+                    break;
+                auto &r = got[done++];
+                r.id = load_le<uint32_t>(in.data() + pos + 4);
+                r.status = reply_status(load_le<uint32_t>(in.data() + pos + 8));
+                r.data.assign(in.data() + pos + response_head, size - (response_head - 4));
+                pos += 4 + size;
+            }
+            memmove(in.data(), in.data() + pos, used - pos);
+            used -= pos;
+        }
+        out.clear();
+        pending = 0;
+    }
+
+private:
+    int fd;
+    std::string out;
+    std::vector<char> in;
+    size_t pending = 0;
+    uint32_t next_id = 0;
+    std::vector<reply> replies;
+};
+
+}
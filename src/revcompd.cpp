@@ -0,0 +1,432 @@
+/*
+  revcompd - revcomp as a daemon, for services which ask for many small regions.
+
+  usage: revcompd serve [--threads=N] [--kernel=NAME] SOCKET NAME=FASTA...
+         revcompd get SOCKET REFERENCE SEQUENCE START END
+         revcompd bench FASTA [requests=100000] [length=100] [depth=1]
+
+  A revcomp call pays process start, index scan and cold page cache for every region.
+  serve maps and indexes the references once (references.hpp) and answers region
+  requests on unix socket SOCKET (daemon_protocol.hpp, client is revcomp_client.hpp).
+
+  Workers (--threads, default cpus allowed by affinity and quota) share one epoll. A
+  connection is armed EPOLLONESHOT, so exactly one worker takes it when it's readable,
+  reads all requests which came (a batch), answers them into one buffer, sends it with
+  one send() and re-arms it - connections spread over the pool and pipelined requests
+  cost one syscall each way per batch, not per request. Replies of a batch are sent in
+  parts of up to 256MB (4 x max_region), so many big regions asked at once don't
+  take a worker's memory without bound. SIGINT/SIGTERM stop it and
+  remove the socket.
+
+  get prints one region. bench serves FASTA from this process on a socket in /tmp and
+  asks for random regions like a client would, depth requests per round trip, checks
+  every reply against swmap (complement.hpp) and prints round trip percentiles.
+  100bp regions of revcomp-input x 24000 (245MB), one cpu: round trip p50 4.8us,
+  p99 16us, 137000 requests/s; 16 per round trip 508000 requests/s. A `revcomp`
+  process on a 10KB file takes 5.6ms.
+*/
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unordered_set>
+
+#include "complement.hpp"
+#include "references.hpp"
+#include "revcomp_client.hpp"
+#include "topology.hpp"
+
+namespace revcomp {
+
+class region_server {
+public:
+    // region(body, width, start, end, out) - revcomp_region of some kernel
+    using region_fn = size_t (*)(const char*, size_t, size_t, size_t, char*);
+
+    region_server(const reference_set &refs, const std::string &path, region_fn region)
+        : refs(refs), path(path), region(region) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof addr.sun_path)
+            throw std::invalid_argument("socket path too long: " + path);
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        // socket left by a daemon which was killed, unless one still answers on it
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            try {
+                revcomp_client probe{path};
+            } catch (const std::system_error &) {
+                unlink(path.c_str());
+            }
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener == -1)
+            throw std::system_error(errno, std::generic_category(), "socket");
+        if (bind(listener, (const sockaddr*)&addr, sizeof addr) || listen(listener, SOMAXCONN)) {
+            auto err = errno;
+            close(listener);
+            throw std::system_error(err, std::generic_category(), path);
+        }
+        epoll = epoll_create1(EPOLL_CLOEXEC);
+        wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (epoll == -1 || wake == -1)
+            throw std::system_error(errno, std::generic_category(), "epoll");
+        watch(listener, &listener, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wake, &wake, EPOLLIN, EPOLL_CTL_ADD);
+    }
+    region_server(const region_server&) = delete;
+    region_server& operator=(const region_server&) = delete;
+    ~region_server() {
+        stop();
+        for (auto c : connections) {
+            close(c->fd);
+            delete c;
+        }
+        close(epoll);
+        close(wake);
+        close(listener);
+        unlink(path.c_str());
+    }
+
+    void start(size_t threads) {
+        for (size_t t = 0; t < std::max<size_t>(threads, 1); t++)
+            workers.emplace_back([this] { work(); });
+    }
+
+    // wake every worker (eventfd stays readable) and wait for them
+    void stop() {
+        uint64_t one = 1;
+        if (write(wake, &one, sizeof one) < 0 && errno != EAGAIN)
+            perror("revcompd: eventfd");
+        for (auto &w : workers)
+            w.join();
+        workers.clear();
+    }
+
+    uint64_t requests() const { return served.load(std::memory_order_relaxed); }
+
+private:
+    struct connection {
+        int fd;
+        std::vector<char> in;
+        size_t used = 0;
+        std::string out;
+    };
+
+    static constexpr size_t batch_limit = 1 << 20;  // request bytes read at once
+    static constexpr size_t reply_limit = 4 * max_region;  // reply bytes sent at once, less one answer
+
+    void watch(int fd, void *tag, uint32_t events, int op) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.ptr = tag;
+        if (epoll_ctl(epoll, op, fd, &ev))
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+    }
+
+    void work() {
+        while (true) {
+            epoll_event ev;
+            auto n = epoll_wait(epoll, &ev, 1, -1);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0) {
+                perror("revcompd: epoll_wait");
+                return;
+            }
+            if (ev.data.ptr == &wake)
+                return;
+            if (ev.data.ptr == &listener) {
+                accept_all();
+                continue;
+            }
+            auto c = static_cast<connection*>(ev.data.ptr);
+            if (serve(*c))
+                watch(c->fd, c, EPOLLIN | EPOLLONESHOT, EPOLL_CTL_MOD);
+            else
+                drop(c);
+        }
+    }
+
+    void accept_all() {
+        while (true) {
+            auto fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd == -1) {
+                if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+                    perror("revcompd: accept");
+                return;
+            }
+            auto c = new connection{fd, {}, 0, {}};
+            {
+                std::lock_guard lock{guard};
+                connections.insert(c);
+            }
+            watch(fd, c, EPOLLIN | EPOLLONESHOT, EPOLL_CTL_ADD);
+        }
+    }
+
+    void drop(connection *c) {
+        {
+            std::lock_guard lock{guard};
+            connections.erase(c);
+        }
+        close(c->fd);
+        delete c;
+    }
+
+    // requests which came on c, answered in one send per reply_limit; false - close it
+    bool serve(connection &c) {
+        auto open = true;
+        while (c.used < batch_limit) {
+            if (c.in.size() - c.used < (64 << 10))
+                c.in.resize(std::max(c.in.size() * 2, c.used + (64 << 10)));
+            auto bytes = recv(c.fd, c.in.data() + c.used, c.in.size() - c.used, 0);
+            if (bytes > 0) {
+                c.used += bytes;
+                if (c.used < c.in.size())
+                    break;
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            open = bytes < 0 && errno == EAGAIN;
+            break;
+        }
+
+        // a batch of big regions goes out in parts, a worker holds up to reply_limit + max_region
+        for (auto more = true; more;) {
+            c.out.clear();
+            size_t pos = 0, batch = 0;
+            try {
+                region_request r;
+                size_t n = 0;
+                while (c.out.size() < reply_limit && (n = decode_request(c.in.data() + pos, c.used - pos, r))) {
+                    answer(r, c.out);
+                    pos += n;
+                    batch++;
+                }
+                more = c.out.size() >= reply_limit;
+            } catch (const std::exception &e) {
+                fprintf(stderr, "revcompd: %s, connection closed\n", e.what());
+                return false;
+            }
+            memmove(c.in.data(), c.in.data() + pos, c.used - pos);
+            c.used -= pos;
+            served.fetch_add(batch, std::memory_order_relaxed);
+            if (!send_all(c))
+                return false;
+        }
+        if (c.out.capacity() > batch_limit)
+            std::string().swap(c.out);
+        return open;
+    }
+
+    void answer(const region_request &r, std::string &out) {
+        auto fail = [&](reply_status status, const std::string &message) {
+            memcpy(encode_response(out, r.id, status, message.size()), message.data(), message.size());
+        };
+        auto ref = refs.find(r.reference);
+        if (ref == refs.end())
+            return fail(reply_status::not_found, "no reference " + std::string(r.reference));
+        auto rec = ref->second->find(r.sequence);
+        if (!rec)
+            return fail(reply_status::not_found,
+                        "no sequence " + std::string(r.sequence) + " in " + std::string(r.reference));
+        auto n = rec->residues();
+        if (r.start > r.end || r.end > n || r.end - r.start > max_region)
+            return fail(reply_status::bad_range, "region [" + std::to_string(r.start) + ", " +
+                        std::to_string(r.end) + ") of " + std::string(r.sequence) + " with " +
+                        std::to_string(n) + " residues");
+        auto o = encode_response(out, r.id, reply_status::ok, r.end - r.start);
+        region(ref->second->data() + rec->body, rec->width, r.start, r.end, o);
+    }
+
+    // client which doesn't read its replies for 10s is dropped, it holds a worker
+    bool send_all(connection &c) {
+        for (size_t done = 0; done < c.out.size();) {
+            auto bytes = send(c.fd, c.out.data() + done, c.out.size() - done, MSG_NOSIGNAL);
+            if (bytes >= 0) {
+                done += bytes;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            pollfd p{c.fd, POLLOUT, 0};
+            if (errno != EAGAIN || poll(&p, 1, 10000) <= 0)
+                return false;
+        }
+        return true;
+    }
+
+    const reference_set &refs;
+    std::string path;
+    region_fn region;
+    int listener = -1, epoll = -1, wake = -1;
+    std::vector<std::thread> workers;
+    std::mutex guard;
+    std::unordered_set<connection*> connections;
+    std::atomic<uint64_t> served{0};
+};
+
+static size_t default_threads() {
+    return topology::host().default_threads();
+}
+
+static int serve(int argc, char **argv) {
+    size_t threads = default_threads();
+    std::string kernel = "auto";
+    int i = 0;
+    for (; i < argc && std::string_view(argv[i]).starts_with("--"); i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--threads="))
+            threads = std::stoul(std::string(arg.substr(10)));
+        else if (arg.starts_with("--kernel="))
+            kernel = arg.substr(9);
+        else
+            throw std::invalid_argument("unknown option " + std::string(arg));
+    }
+    if (argc - i < 2)
+        throw std::invalid_argument("serve needs SOCKET and NAME=FASTA");
+    std::string path = argv[i++];
+
+    // signals go to sigwait below, not to workers
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+
+    reference_set refs;
+    for (; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto eq = arg.find('=');
+        if (eq == arg.npos || eq == 0)
+            throw std::invalid_argument("expected NAME=FASTA, got " + std::string(arg));
+        auto name = std::string(arg.substr(0, eq));
+        auto ref = std::make_unique<reference>(std::string(arg.substr(eq + 1)));
+        fprintf(stderr, "revcompd: %s: %zu sequences\n", name.c_str(), ref->sequences());
+        if (!refs.try_emplace(name, std::move(ref)).second)
+            throw std::invalid_argument("reference " + name + " given twice");
+    }
+    region_server::region_fn region = nullptr;
+    with_kernel(kernel, [&]<class K>() { region = &revcomp_region<K>; });
+
+    region_server server{refs, path, region};
+    server.start(threads);
+    fprintf(stderr, "revcompd: serving %zu references on %s, %zu workers\n", refs.size(), path.c_str(),
+            std::max<size_t>(threads, 1));
+    int signal;
+    sigwait(&stop_signals, &signal);
+    server.stop();
+    fprintf(stderr, "revcompd: %s, %llu requests served\n", strsignal(signal),
+            (unsigned long long)server.requests());
+    return 0;
+}
+
+static int get(int argc, char **argv) {
+    if (argc != 5)
+        throw std::invalid_argument("get needs SOCKET REFERENCE SEQUENCE START END");
+    revcomp_client client{argv[0]};
+    auto residues = client.get(argv[1], argv[2], std::stoull(argv[3]), std::stoull(argv[4]));
+    residues += '\n';
+    fwrite(residues.data(), 1, residues.size(), stdout);
+    return 0;
+}
+
+static int bench(int argc, char **argv) {
+    if (argc < 1)
+        throw std::invalid_argument("bench needs FASTA");
+    size_t requests = argc > 1 ? std::stoul(argv[1]) : 100000;
+    size_t length = argc > 2 ? std::stoul(argv[2]) : 100;
+    size_t depth = std::max<size_t>(argc > 3 ? std::stoul(argv[3]) : 1, 1);
+
+    reference_set refs;
+    auto &ref = *refs.try_emplace("bench", std::make_unique<reference>(argv[0])).first->second;
+    std::vector<const record*> long_enough;
+    for (auto &r : ref.records())
+        if (r.residues() >= length)
+            long_enough.push_back(&r);
+    if (long_enough.empty())
+        throw std::invalid_argument(std::string(argv[0]) + " has no sequence of " + std::to_string(length) +
+                                    " residues");
+    auto name = [&](const record &r) {
+        return record_name({ref.data() + r.header, r.body - r.header});
+    };
+    auto path = "/tmp/revcompd-bench-" + std::to_string(getpid()) + ".sock";
+    region_server server{refs, path, &revcomp_region<default_kernel>};
+    server.start(default_threads());
+
+    revcomp_client client{path};
+    std::vector<revcomp_client::reply> replies;
+    client.queue("bench", "", 0, 1);
+    client.wait(replies);
+    if (replies[0].status != reply_status::not_found)
+        throw std::runtime_error("sequence without name was answered");
+
+    struct asked {
+        const record *r;
+        uint64_t start;
+    };
+    std::vector<asked> batch;
+    std::vector<uint64_t> round_trips;
+    std::mt19937_64 rng{42};
+    size_t wrong = 0;
+    std::string want;
+    auto t0 = monotonic_now();
+    for (size_t done = 0; done < requests; done += depth) {
+        batch.clear();
+        for (size_t k = 0; k < depth; k++) {
+            auto r = long_enough[rng() % long_enough.size()];
+            auto start = rng() % (r->residues() - length + 1);
+            batch.push_back({r, start});
+            client.queue("bench", name(*r), start, start + length);
+        }
+        auto t = monotonic_now();
+        client.wait(replies);
+        round_trips.push_back(monotonic_now() - t);
+        for (size_t k = 0; k < depth; k++) {
+            auto &[r, start] = batch[k];
+            want.clear();
+            for (auto i = start + length; i-- > start;)
+                want += char(swmap(uint8_t(ref.data()[r->body + residue_offset(i, r->width)])));
+            wrong += replies[k].status != reply_status::ok || replies[k].data != want;
+        }
+    }
+    auto seconds = double(monotonic_now() - t0) / 1e9;
+    std::sort(round_trips.begin(), round_trips.end());
+    auto us = [&](double q) { return double(round_trips[size_t(q * double(round_trips.size() - 1))]) / 1e3; };
+    printf("%zu requests of %zu residues, %zu per round trip: %.0f requests/s, round trip p50 %.1fus "
+           "p99 %.1fus max %.1fus, %zu wrong\n", round_trips.size() * depth, length, depth,
+           double(round_trips.size() * depth) / seconds, us(0.5), us(0.99), us(1.0), wrong);
+    return wrong ? 1 : 0;
+}
+
+}
+
+int main(int argc, char **argv) {
+    try {
+        std::string_view command = argc > 1 ? argv[1] : "";
+        if (command == "serve")
+            return revcomp::serve(argc - 2, argv + 2);
+        if (command == "get")
+            return revcomp::get(argc - 2, argv + 2);
+        if (command == "bench")
+            return revcomp::bench(argc - 2, argv + 2);
+        fputs("usage: revcompd serve [--threads=N] [--kernel=NAME] SOCKET NAME=FASTA...\n"
+              "       revcompd get SOCKET REFERENCE SEQUENCE START END\n"
+              "       revcompd bench FASTA [requests=100000] [length=100] [depth=1]\n", stderr);
+        return 1;
+    } catch (const std::exception &e) {
+        fprintf(stderr, "revcompd: %s\n", e.what());
+        return 1;
+    }
+}
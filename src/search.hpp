@@ -0,0 +1,436 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <immintrin.h>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "complement.hpp"
+#include "engine.hpp"
+
+/*
+  revcomp --search=PATTERN[,PATTERN...]
+
+  Where patterns occur on either strand, without writing the reverse complement and
+  grepping it. Each pattern is reverse-complemented once (map256, IUPAC codes
+  complement as in swmap) and the input is scanned forward once for all of them.
+  Output is BED, a line per hit: record (header up to first space), 0-based start
+  and end on the forward strand, pattern as given, 0, + or -. A palindromic pattern
+  (EcoRI GAATTC) hits both strands at the same place, both are reported.
+
+  Patterns are IUPAC (ACGTU RYSWKM BDHV N, any case). Position i of a pattern is a set
+  of bases, a residue matches it when it's a code too and all its bases are in the
+  set: N in a pattern takes anything, A doesn't take N or R of the input.
+
+  The scan is Shift-And (bitap): every pattern of both strands gets as many bits of a
+  64-bit word as it's long, bit i set in state means "pattern positions 0..i match
+  the text ending here". One residue updates all of them at once,
+    state = ((state << 1) | starts) & table[byte]
+  table[byte] having a bit for every pattern position which takes that byte, a hit
+  is a set bit of `ends`. Patterns go longest first to the first word with room,
+  up to `max_words` (64 per pattern, 256 of both strands together); the number of
+  words is a template parameter, so for the usual one there is no inner loop.
+  \n and \r are skipped, state carries over line breaks and read_chunk pieces; a
+  header resets it.
+
+  Hits are rare, the cost of bitap is the shift -> or -> and chain through state, 3
+  cycles per residue whatever the patterns in a word are. So with AVX2 most residues
+  don't go through it: every oriented pattern has an anchor, its first longest run of
+  up to anchor_bases (6) unambiguous bases, and 32 positions at a time are compared
+  with all anchors (6 loads, a cmpeq per base and anchor). Bitap runs from
+  anchor_reach (biggest anchor offset) residues before a candidate until no partial
+  match is past its anchor, then blocks are compared again. Line breaks are dropped
+  first - each read_chunk piece is copied to `residues`, memchr + memcpy per line -
+  so anchors across a line break are compared like any other. A pattern without an
+  unambiguous base (NNNN, RYRY) leaves bitap alone for all of them.
+
+  big.fa (245MB) from /dev/shm, 2.1GHz 1 vCPU: GAATTC (1 word) 0.43s with bitap
+  alone, 0.21s with anchors; three 16S primers with ambiguity codes (2 words, 6
+  anchors) 0.63s and 0.32s. 4-base anchors were 0.20s and 0.49s, candidates of 6
+  anchors every ~40 residues cost more than the longer compare. Writing the reverse
+  complement alone takes 0.27s before anything greps it.
+*/
+
+namespace revcomp {
+
+// IUPAC code -> set of bases A C G T = 1 2 4 8, 0 - not a code
+constexpr auto base_sets = ([] {
+    std::array<uint8_t, 256> sets{};
+    constexpr std::pair<char, uint8_t> codes[] = {
+        {'A', 1}, {'C', 2}, {'G', 4}, {'T', 8}, {'U', 8}, {'R', 5}, {'Y', 10}, {'S', 6},
+        {'W', 9}, {'K', 12}, {'M', 3}, {'B', 14}, {'D', 13}, {'H', 11}, {'V', 7}, {'N', 15}};
+    for (auto [c, set] : codes)
+        sets[uint8_t(c)] = sets[uint8_t(c | 0x20)] = set;
+    return sets;
+})();
+
+class pattern_set {
+public:
+    static constexpr size_t max_words = 4;
+
+    struct oriented {
+        size_t pattern;     // index in patterns
+        char strand;
+        size_t word, end_bit;
+    };
+
+    // comma separated list
+    explicit pattern_set(std::string_view list) {
+        for (size_t pos = 0; pos <= list.size();) {
+            auto comma = std::min(list.find(',', pos), list.size());
+            patterns.emplace_back(list.substr(pos, comma - pos));
+            pos = comma + 1;
+        }
+        // longest first packs words tighter, hits are reported in order of patterns
+        std::vector<size_t> order(patterns.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](auto a, auto b) { return patterns[a].size() > patterns[b].size(); });
+        for (auto i : order) {
+            auto &p = patterns[i];
+            if (p.empty() || p.size() > 64)
+                throw std::invalid_argument("--search patterns need 1 to 64 bases");
+            std::string rc(p.rbegin(), p.rend());
+            for (auto &c : rc) {
+                if (!base_sets[uint8_t(c)])
+                    throw std::invalid_argument("--search pattern " + p + ": not an IUPAC code '" + c + "'");
+                c = char(map256[uint8_t(c)]);
+            }
+            add(p, i, '+');
+            add(rc, i, '-');
+        }
+        std::stable_sort(oriented_patterns.begin(), oriented_patterns.end(),
+                         [](auto &a, auto &b) { return a.pattern < b.pattern; });
+        if (!all_anchored)
+            anchors.clear();
+    }
+
+    // up to anchor_bases unambiguous bases in a row of an oriented pattern, `offset` residues from its start
+    static constexpr size_t anchor_bases = 6;
+    struct anchor {
+        size_t offset, length;
+        char bases[anchor_bases];   // lowercase, u is t
+    };
+
+    size_t words() const { return starts.size(); }
+
+    std::vector<std::string> patterns;
+    std::vector<oriented> oriented_patterns;
+    std::vector<uint64_t> starts, ends;
+    std::vector<uint64_t> table;    // [byte * words() + word]
+    std::vector<anchor> anchors;    // empty if some pattern has no unambiguous base
+    size_t anchor_reach = 0;        // biggest offset
+    // bits of partial matches whose anchor began anchor_bases or more residues ago
+    std::vector<uint64_t> past_anchor;
+
+private:
+    // into the first word with room for it
+    void add(const std::string &p, size_t pattern, char strand) {
+        size_t w = 0;
+        while (w < used.size() && used[w] + p.size() > 64)
+            w++;
+        if (w == used.size()) {
+            if (w == max_words)
+                throw std::invalid_argument("--search patterns are too long together, up to 256 bases of both strands");
+            used.push_back(0);
+            starts.push_back(0);
+            ends.push_back(0);
+            past_anchor.push_back(0);
+            std::vector<uint64_t> wider(256 * used.size());
+            for (size_t b = 0; b < 256; b++)
+                for (size_t v = 0; v < w; v++)
+                    wider[b * used.size() + v] = table[b * w + v];
+            table.swap(wider);
+        }
+        auto first = used[w], last = first + p.size() - 1;
+        starts[w] |= 1ull << first;
+        ends[w] |= 1ull << last;
+        oriented_patterns.push_back({pattern, strand, w, last});
+        for (size_t b = 0; b < 256; b++) {
+            auto text = base_sets[b];
+            for (size_t i = 0; i < p.size(); i++)
+                if (text && !(text & ~base_sets[uint8_t(p[i])]))
+                    table[b * used.size() + w] |= 1ull << (first + i);
+        }
+        used[w] += p.size();
+        auto offset = add_anchor(p);
+        for (auto i = offset + anchor_bases; i < p.size(); i++)
+            past_anchor[w] |= 1ull << (first + i);
+    }
+
+    // the first longest run, palindromes give the same anchor twice; returns its offset
+    size_t add_anchor(const std::string &p) {
+        anchor best{0, 0, {}};
+        for (size_t i = 0; i < p.size(); i++) {
+            size_t n = 0;
+            while (n < anchor_bases && i + n < p.size() && std::has_single_bit(base_sets[uint8_t(p[i + n])]))
+                n++;
+            if (n > best.length)
+                best = {i, n, {}};
+        }
+        for (size_t k = 0; k < best.length; k++)
+            best.bases[k] = "acgt"[std::countr_zero(base_sets[uint8_t(p[best.offset + k])])];
+        all_anchored &= best.length > 0;
+        auto same = [&](const anchor &a) {
+            return a.offset == best.offset && a.length == best.length && !memcmp(a.bases, best.bases, best.length);
+        };
+        if (std::none_of(anchors.begin(), anchors.end(), same))
+            anchors.push_back(best);
+        anchor_reach = std::max(anchor_reach, best.offset);
+        return best.offset;
+    }
+
+    std::vector<size_t> used;   // bits of each word
+    bool all_anchored = true;
+};
+
+template <size_t W>
+class pattern_scanner {
+public:
+    pattern_scanner(const pattern_set &set, output_buffer &out) : set(set), out(out) {
+        for (size_t w = 0; w < W; w++) {
+            starts[w] = set.starts[w];
+            ends[w] = set.ends[w];
+            past_anchor[w] = set.past_anchor[w];
+        }
+#ifdef __AVX2__
+        // a shorter anchor takes anything at its missing positions
+        for (auto &a : set.anchors) {
+            anchor_bytes v;
+            for (size_t k = 0; k < pattern_set::anchor_bases; k++) {
+                v.bases[k] = _mm256_set1_epi8(k < a.length ? a.bases[k] : 0);
+                v.open[k] = _mm256_set1_epi8(k < a.length ? 0 : -1);
+            }
+            anchors.push_back(v);
+        }
+#endif
+    }
+
+    void begin_record(std::string_view name) {
+        record.assign(name);
+        state = {};
+        pos = seen = 0;
+    }
+
+    // residues of one record, \n and \r skipped
+    void scan(const char *p, const char *end) {
+#ifdef __AVX2__
+        if (!anchors.empty()) {
+            auto n = compact(p, end);
+            return scan_residues(residues.data(), residues.data() + n);
+        }
+#endif
+        for (; p < end; p++)
+            if (*p != '\n' && *p != '\r')
+                step(uint8_t(*p));
+    }
+
+private:
+    void step(uint8_t c) {
+        auto *row = set.table.data() + c * W;
+        uint64_t hit = 0;
+        for (size_t w = 0; w < W; w++) {
+            state[w] = ((state[w] << 1) | starts[w]) & row[w];
+            hit |= state[w] & ends[w];
+        }
+        if (hit) [[unlikely]]
+            report();
+        pos++;
+    }
+
+#ifdef __AVX2__
+    static constexpr size_t block = 32, lookahead = pattern_set::anchor_bases - 1;
+
+    // [p, end) without line breaks to residues, returns how many
+    size_t compact(const char *p, const char *end) {
+        residues.resize(size_t(end - p));
+        auto *o = residues.data();
+        if (memchr(p, '\r', size_t(end - p)))
+            return size_t(std::remove_copy_if(p, end, o, [](char c) { return c == '\n' || c == '\r'; }) - o);
+        while (p < end) {
+            auto nl = (const char*)memchr(p, '\n', size_t(end - p));
+            auto n = size_t((nl ? nl : end) - p);
+            memcpy(o, p, n);
+            o += n;
+            p += n + 1;
+        }
+        return size_t(o - residues.data());
+    }
+
+    // no partial match has gone anchor_bases past its anchor, all of them began at or after `settled`
+    bool may_skip(size_t settled) const {
+        uint64_t live = 0, old = 0;
+        for (size_t w = 0; w < W; w++) {
+            live |= state[w];
+            old |= state[w] & past_anchor[w];
+        }
+        return !old && (!live || pos >= settled);
+    }
+
+    /*
+      Partial matches which haven't gone anchor_bases past their anchor are dropped,
+      blocks from anchor_bases residues back are searched for anchors and only counted
+      until one is found. Bitap starts over anchor_reach residues before it (or at the
+      start of residues) and goes through it; matches it finds again are not reported
+      twice (seen).
+    */
+    void scan_residues(const char *p, const char *end) {
+        auto lo = p;
+        auto settled = pos + 64;        // partial matches after it began in [lo, end)
+        const char *through = nullptr;  // last anchor bitap went through
+        while (size_t(end - p) >= block + lookahead) {
+            auto from = p - std::min<size_t>(pattern_set::anchor_bases, size_t(p - lo));
+            if (!may_skip(settled) || (through && from <= through)) {
+                step(uint8_t(*p++));
+                continue;
+            }
+            seen = std::max(seen, pos);
+            state = {};
+            pos -= size_t(p - from);
+            p = from;
+            uint32_t found = 0;
+            for (; size_t(end - p) >= block + lookahead; p += block, pos += block)
+                if ((found = candidates(p)))
+                    break;
+            // the tail after the last block is like an anchor, bitap goes on from before it
+            auto anchor = p + (found ? std::countr_zero(found) : 0);
+            pos += size_t(anchor - p);
+            p = anchor - std::min(set.anchor_reach, size_t(anchor - lo));
+            pos -= size_t(anchor - p);
+            if (!found)
+                break;
+            while (p <= anchor)
+                step(uint8_t(*p++));
+            through = anchor;
+        }
+        for (; p < end; p++)
+            step(uint8_t(*p));
+    }
+
+    // bit i: an anchor starts at p[i]
+    uint32_t candidates(const char *p) const {
+        // lowercase, u as t
+        auto fold = [](__m256i v) {
+            v = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            return _mm256_sub_epi8(v, _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('u')),
+                                                       _mm256_set1_epi8(1)));
+        };
+        constexpr size_t n = pattern_set::anchor_bases;
+        __m256i bytes[n];
+        for (size_t k = 0; k < n; k++)
+            bytes[k] = fold(_mm256_loadu_si256((const __m256i*)(p + k)));
+        auto any = _mm256_setzero_si256();
+        for (auto &a : anchors) {
+            auto m = _mm256_or_si256(a.open[0], _mm256_cmpeq_epi8(bytes[0], a.bases[0]));
+            for (size_t k = 1; k < n; k++)
+                m = _mm256_and_si256(m, _mm256_or_si256(a.open[k], _mm256_cmpeq_epi8(bytes[k], a.bases[k])));
+            any = _mm256_or_si256(any, m);
+        }
+        return uint32_t(_mm256_movemask_epi8(any));
+    }
+#endif
+
+    void report() {
+        if (pos < seen)
+            return;
+        for (auto &o : set.oriented_patterns) {
+            if (!(state[o.word] >> o.end_bit & 1))
+                continue;
+            auto &p = set.patterns[o.pattern];
+            auto line = out.reserve(record.size() + p.size() + 64);
+            auto n = snprintf(line, record.size() + p.size() + 64, "%s\t%zu\t%zu\t%s\t0\t%c\n", record.c_str(),
+                              pos + 1 - p.size(), pos + 1, p.c_str(), o.strand);
+            out.commit(size_t(n));
+        }
+    }
+
+    const pattern_set &set;
+    output_buffer &out;
+    std::array<uint64_t, W> starts, ends, past_anchor, state{};
+#ifdef __AVX2__
+    // broadcast bases of pattern_set::anchor, open is all ones past its length (takes anything)
+    struct anchor_bytes {
+        __m256i bases[pattern_set::anchor_bases], open[pattern_set::anchor_bases];
+    };
+    std::vector<anchor_bytes> anchors;
+    std::vector<char> residues;     // of the piece being scanned
+#endif
+    std::string record;
+    size_t pos = 0;     // residues of record before the current one
+    size_t seen = 0;    // hits before it are reported, bitap may go over them again
+};
+
+/*
+  Reads FASTA from in, hits go to out as BED. Same walk over pieces as run_kmers:
+  headers are collected (they may span pieces), bodies go to the scanner up to the
+  next line starting with '>'.
+*/
+template <size_t W>
+static void run_search_words(int in, output_buffer &out, const pattern_set &set, const tuning &tune, stats &st) {
+    pattern_scanner<W> scanner{set, out};
+    std::vector<char> piece(tune.read_chunk);
+    std::string header;
+    bool in_header = false, at_line_start = true;
+
+    while (true) {
+        size_t bytes;
+        {
+            phase_scope scope{st, phase::read};
+            bytes = read_some(in, piece.data(), piece.size(), st);
+        }
+        if (bytes == 0)
+            break;
+        phase_scope scope{st, phase::transform};
+        st.processed(phase::transform, bytes);
+        const char *p = piece.data(), *end = p + bytes;
+        while (p < end) {
+            if (in_header) {
+                auto nl = (const char*)memchr(p, '\n', end - p);
+                header.append(p, nl ? nl : end);
+                p = nl ? nl + 1 : end;
+                at_line_start = true;
+                if (nl) {
+                    in_header = false;
+                    scanner.begin_record(std::string_view(header).substr(0, header.find_first_of(" \t\r")));
+                }
+                continue;
+            }
+            if (at_line_start && *p == '>') {
+                header.clear();
+                st.records++;
+                in_header = true;
+                p++;
+                continue;
+            }
+            auto stop = p;
+            while (stop < end) {
+                auto nl = (const char*)memchr(stop, '\n', end - stop);
+                stop = nl ? nl + 1 : end;
+                if (stop < end && *stop == '>')
+                    break;
+            }
+            scanner.scan(p, stop);
+            at_line_start = stop[-1] == '\n';
+            p = stop;
+        }
+    }
+    out.flush();
+}
+
+static inline void run_search(int in, output_buffer &out, const pattern_set &set, const tuning &tune, stats &st) {
+    switch (set.words()) {
+    case 1: return run_search_words<1>(in, out, set, tune, st);
+    case 2: return run_search_words<2>(in, out, set, tune, st);
+    case 3: return run_search_words<3>(in, out, set, tune, st);
+    default: return run_search_words<4>(in, out, set, tune, st);
+    }
+}
+
+}
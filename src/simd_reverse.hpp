@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+/*
+  simd_reverse(first, last) - std::reverse of bytes with explicit vectors.
+
+  GCC vectorizes std::reverse of chars (~4B/cycle, rev4), clang doesn't (~1B/cycle,
+  "LLVM has problems with std::reverse vectorization" in rev2), so hot loops which
+  call std::reverse run at speed of the compiler which built them. Here both ends are
+  loaded, reversed in registers and stored swapped, widest vector first. When less
+  than two vectors are left in the middle the last swap overlaps (both loads happen
+  before both stores, so bytes written twice get the same value) and what's left
+  after goes to the next narrower width, the last 0..7 bytes to std::reverse. No
+  alignment needed, heads and tails are the same unaligned loads.
+
+  reversed(v) is the register part, kernels (kernels.hpp) reverse with it too:
+    uint64_t   bswap
+    __m128i    pshufb                                   (rev4 reverse_complement_sse)
+    __m256i    pshufb in both lanes, vperm2i128 swaps them          (rev4 reverse())
+    __m512i    vpermb, needs AVX512-VBMI
+  Widths exist as far as the compiler targets them (-march=native in Makefiles).
+*/
+
+namespace revcomp {
+
+static inline uint64_t reversed(uint64_t v) { return __builtin_bswap64(v); }
+
+#ifdef __SSSE3__
+static inline __m128i reversed(__m128i v) {
+    return _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+#endif
+
+#ifdef __AVX2__
+// LOWER.UPPER -> (shuffle) -> REWOL.REPPU -> (permute) -> REPPU.REWOL
+static inline __m256i reversed(__m256i v) {
+    auto lanes = _mm256_shuffle_epi8(v, _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+    return _mm256_permute2x128_si256(lanes, lanes, 1);
+}
+#endif
+
+#if defined(__AVX512BW__) && defined(__AVX512VBMI__)
+static inline __m512i reversed(__m512i v) {
+    auto all = _cvtu64_mask64(~0ull);  // maskz form, plain vpermb intrinsic trips -Wmaybe-uninitialized in gcc 12
+    auto reverse = _mm512_set_epi64(0x0001020304050607, 0x08090a0b0c0d0e0f, 0x1011121314151617,
+                                    0x18191a1b1c1d1e1f, 0x2021222324252627, 0x28292a2b2c2d2e2f,
+                                    0x3031323334353637, 0x38393a3b3c3d3e3f);
+    return _mm512_maskz_permutexvar_epi8(all, reverse, v);
+}
+#endif
+
+// swap reversed V-sized blocks from both ends while they don't meet, true if nothing is left
+template <class V>
+static inline bool reverse_by(char *&first, char *&last) {
+    constexpr ptrdiff_t w = sizeof(V);
+    auto swap_ends = [&] {
+        V a, b;
+        memcpy(&a, first, w);
+        memcpy(&b, last - w, w);
+        a = reversed(a);
+        b = reversed(b);
+        memcpy(first, &b, w);
+        memcpy(last - w, &a, w);
+    };
+    for (; last - first >= 2 * w; first += w, last -= w)
+        swap_ends();
+    if (last - first < w)
+        return false;
+    swap_ends();
+    return true;
+}
+
+static inline void simd_reverse(char *first, char *last) {
+#if defined(__AVX512BW__) && defined(__AVX512VBMI__)
+    if (reverse_by<__m512i>(first, last))
+        return;
+#endif
+#ifdef __AVX2__
+    if (reverse_by<__m256i>(first, last))
+        return;
+#endif
+#ifdef __SSSE3__
+    if (reverse_by<__m128i>(first, last))
+        return;
+#endif
+    if (reverse_by<uint64_t>(first, last))
+        return;
+    std::reverse(first, last);
+}
+
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <sys/resource.h>
+
+#include "perf_counters.hpp"
+
+/*
+  Per-phase metrics, printed as one JSON object to stderr with --stats.
+
+  Replaces commented-out printf around realtime_now() / high_resolution_clock.
+  When disabled every hook is a single predictable branch, when enabled it's one
+  clock_gettime(CLOCK_MONOTONIC) (vDSO, ~20ns) per scope - engines open scopes per
+  block (64KB+), never per line.
+
+  GB/s is just bytes/ns. first_byte_ns is time to first output byte (write() or mapped
+  output), what a consumer on the other end of a pipe waits before it can start.
+
+  --perf adds hardware counters (perf_counters.hpp) per phase, read on every phase switch.
+  They count only the thread which called enable_perf(), so stats filled on another
+  thread (pipeline stage, worker) enable their own there and add() sums them. A phase
+  no counting thread entered prints null, not 0.
+*/
+
+namespace revcomp {
+
+enum class phase { index, read, transform, write };
+constexpr std::array phase_names = {"index", "read", "transform", "write"};
+
+static inline uint64_t monotonic_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000ULL + ts.tv_nsec;
+}
+
+static inline bool has_flag(int argc, char **argv, const char *flag) {
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], flag) == 0)
+            return true;
+    return false;
+}
+
+struct phase_stats {
+    uint64_t ns = 0;
+    uint64_t bytes = 0;
+    uint64_t syscalls = 0;
+    counter_values counters{};
+    bool counted = false;   // counters were read around (some of) ns
+};
+
+class stats {
+public:
+    explicit stats(const char *engine, bool enabled = false)
+        : engine(engine), enabled(enabled), start(monotonic_now()) {}
+
+    stats(const char *engine, int argc, char **argv)
+        : stats(engine, has_flag(argc, argv, "--stats")) {
+        if (has_flag(argc, argv, "--perf"))
+            enable_perf();
+    }
+
+    void enable_perf() {
+        enabled = true;
+        perf = std::make_unique<perf_counters>();
+        last = perf->read();
+    }
+
+    // --perf is on, stats of other threads should enable_perf() on their thread
+    bool counting() const { return bool(perf); }
+
+    phase_stats& operator[](phase p) { return phases[size_t(p)]; }
+    const phase_stats& operator[](phase p) const { return phases[size_t(p)]; }
+
+    // one syscall which moved `bytes` in phase p
+    void syscall(phase p, uint64_t bytes) {
+        auto &s = (*this)[p];
+        s.bytes += bytes;
+        s.syscalls++;
+        if (p == phase::write)
+            output_started();
+    }
+
+    void processed(phase p, uint64_t bytes) {
+        (*this)[p].bytes += bytes;
+        if (p == phase::write)
+            output_started();
+    }
+
+    // metrics of another thread (pipeline stage), ns add up to busy time of the phase
+    void add(const stats &other) {
+        add_counters(other);
+        for (size_t i = 0; i < phases.size(); i++) {
+            phases[i].ns += other.phases[i].ns;
+            phases[i].bytes += other.phases[i].bytes;
+            phases[i].syscalls += other.phases[i].syscalls;
+        }
+        records += other.records;
+        if (other.first_output && (!first_output || other.first_output < first_output))
+            first_output = other.first_output;
+    }
+
+    // only counters of another thread, which worked while this one waited in the same phase
+    void add_counters(const stats &other) {
+        for (size_t i = 0; i < phases.size(); i++) {
+            for (size_t c = 0; c < counter_names.size(); c++)
+                phases[i].counters[c] += other.phases[i].counters[c];
+            phases[i].counted |= other.phases[i].counted;
+        }
+    }
+
+    void print_json(FILE *out) const {
+        if (!enabled)
+            return;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        uint64_t syscalls = 0;
+        for (auto &s : phases)
+            syscalls += s.syscalls;
+
+        fprintf(out, "{\"engine\":\"%s\",\"wall_ns\":%lu,\"first_byte_ns\":%lu,\"records\":%lu,"
+                "\"syscalls\":%lu,\"phases\":{",
+                engine, monotonic_now() - start, first_output ? first_output - start : 0, records, syscalls);
+        for (size_t i = 0; i < phases.size(); i++) {
+            auto &s = phases[i];
+            fprintf(out, "%s\"%s\":{\"ns\":%lu,\"bytes\":%lu,\"syscalls\":%lu,\"gbps\":%.3f",
+                    i ? "," : "", phase_names[i], s.ns, s.bytes, s.syscalls,
+                    s.ns ? double(s.bytes) / double(s.ns) : 0.0);
+            if (perf)
+                print_counters(out, s);
+            fputc('}', out);
+        }
+        fprintf(out, "},\"max_rss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld}\n",
+                usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt);
+    }
+
+    const char *engine;
+    bool enabled;
+    uint64_t records = 0;
+
+private:
+    friend class phase_scope;
+
+    void output_started() {
+        if (enabled && !first_output)
+            first_output = monotonic_now();
+    }
+
+    void enter(int p) {
+        auto now = monotonic_now();
+        if (perf) {
+            auto values = perf->read();
+            if (current >= 0) {
+                for (size_t i = 0; i < values.size(); i++)
+                    phases[current].counters[i] += values[i] - last[i];
+                phases[current].counted = true;
+            }
+            last = values;
+        }
+        if (current >= 0)
+            phases[current].ns += now - since;
+        current = p;
+        since = now;
+    }
+
+    void print_counters(FILE *out, const phase_stats &s) const {
+        fputs(",\"perf\":{", out);
+        for (size_t i = 0; i < counter_names.size(); i++) {
+            if (s.counted && perf->available(i))
+                fprintf(out, "%s\"%s\":%.0f", i ? "," : "", counter_names[i], s.counters[i]);
+            else
+                fprintf(out, "%s\"%s\":null", i ? "," : "", counter_names[i]);
+        }
+        if (!s.counted || !perf->available(0) || !perf->available(1)) {
+            fputs(",\"ipc\":null,\"cycles_per_byte\":null}", out);
+            return;
+        }
+        auto cycles = s.counters[0], instructions = s.counters[1];
+        fprintf(out, ",\"ipc\":%.3f,\"cycles_per_byte\":%.3f}",
+                cycles ? instructions / cycles : 0.0, s.bytes ? cycles / double(s.bytes) : 0.0);
+    }
+
+    uint64_t start;
+    uint64_t first_output = 0;  // monotonic_now() of first output byte, 0 - none yet
+    std::array<phase_stats, phase_names.size()> phases{};
+    int current = -1;
+    uint64_t since = 0;
+    std::unique_ptr<perf_counters> perf;
+    counter_values last{};
+};
+
+// charges wall time of its lifetime to phase p, nested scope pauses outer one
+// (e.g. output flush inside transform loop is counted as write only)
+class phase_scope {
+public:
+    phase_scope(stats &s, phase p) : s(s), prev(s.current) {
+        if (s.enabled)
+            s.enter(int(p));
+    }
+    phase_scope(const phase_scope&) = delete;
+    phase_scope& operator=(const phase_scope&) = delete;
+    ~phase_scope() {
+        if (s.enabled)
+            s.enter(prev);
+    }
+
+private:
+    stats &s;
+    int prev;
+};
+
+}
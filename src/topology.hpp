@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+/*
+  CPU topology for parallel paths.
+
+  On two-socket hosts a worker which streams through buffer allocated on the other node
+  gets a fraction of memory bandwidth. So workers are pinned, spread over nodes first
+  and over physical cores before SMT siblings, and their buffers are bound to their
+  node and first-touched by them.
+
+  Everything comes from sysfs and cgroup files. Missing node directory (no NUMA in
+  kernel, containers) means one node, missing topology files mean every cpu is own core.
+*/
+
+namespace revcomp {
+
+struct cpu_slot {
+    int cpu = 0;
+    int node = 0;
+    int package = 0;
+    int core = 0;
+    int sibling = 0;    // rank among SMT siblings of its core
+};
+
+// "0-3,8-11" -> {0, 1, 2, 3, 8, 9, 10, 11}, node lists are the same format
+static inline std::vector<int> parse_cpulist(const std::string &text) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        auto comma = text.find(',', pos);
+        auto item = text.substr(pos, comma == text.npos ? text.npos : comma - pos);
+        pos = comma == text.npos ? text.size() : comma + 1;
+        if (item.find_first_of("0123456789") == item.npos)
+            continue;
+        auto dash = item.find('-');
+        auto lo = std::stoi(item), hi = dash == item.npos ? lo : std::stoi(item.substr(dash + 1));
+        for (auto c = lo; c <= hi; c++)
+            cpus.push_back(c);
+    }
+    return cpus;
+}
+
+template <class T>
+static inline bool read_value(const std::string &path, T &value) {
+    std::ifstream in(path);
+    return bool(in >> value);
+}
+
+/*
+  CPUs the cgroup lets us use, 0 = no limit. v2 cpu.max is "max 100000" or
+  "quota period", v1 has cpu.cfs_quota_us (-1 = no limit) and cpu.cfs_period_us.
+  Limit may be set on any ancestor, the tightest one wins.
+*/
+static inline double cgroup_cpu_limit() {
+    std::ifstream self("/proc/self/cgroup");
+    std::string line;
+    double limit = 0;
+    auto tighten = [&](double cpus) {
+        if (cpus > 0 && (limit == 0 || cpus < limit))
+            limit = cpus;
+    };
+    while (std::getline(self, line)) {
+        auto c1 = line.find(':'), c2 = line.find(':', c1 + 1);
+        if (c1 == line.npos || c2 == line.npos)
+            continue;
+        auto controllers = "," + line.substr(c1 + 1, c2 - c1 - 1) + ",";
+        auto path = line.substr(c2 + 1);
+        auto v2 = controllers == ",,";
+        if (!v2 && controllers.find(",cpu,") == controllers.npos)
+            continue;
+
+        auto root = std::string(v2 ? "/sys/fs/cgroup" : "/sys/fs/cgroup/cpu");
+        while (true) {
+            auto dir = root + (path == "/" ? "" : path);
+            if (v2) {
+                std::ifstream max(dir + "/cpu.max");
+                std::string quota;
+                double period;
+                if (max >> quota >> period && quota != "max")
+                    tighten(std::stod(quota) / period);
+            } else {
+                double quota, period;
+                if (read_value(dir + "/cpu.cfs_quota_us", quota) &&
+                    read_value(dir + "/cpu.cfs_period_us", period) && quota > 0)
+                    tighten(quota / period);
+            }
+            if (path.empty() || path == "/")
+                break;
+            path = path.substr(0, path.rfind('/'));
+        }
+    }
+    return limit;
+}
+
+class topology {
+public:
+    // allowed cpus of this process in placement order
+    std::vector<cpu_slot> cpus;
+    int nodes = 1;              // highest node number + 1, some below may be missing
+    double cpu_limit = 0;   // cgroup quota in cpus, 0 = none
+
+    static topology host() {
+        topology t;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed))
+            CPU_SET(0, &allowed);
+
+        // node numbers may have gaps (offlined or memory-only nodes), "online" lists them
+        std::vector<int> node_of(CPU_SETSIZE, 0);
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        std::getline(online, nodes);
+        for (auto node : parse_cpulist(nodes)) {
+            std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string text;
+            if (node >= 1024 || !std::getline(list, text))
+                continue;
+            for (auto cpu : parse_cpulist(text))
+                if (cpu < CPU_SETSIZE)
+                    node_of[cpu] = node;
+            t.nodes = std::max(t.nodes, node + 1);
+        }
+
+        std::vector<cpu_slot> found;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed))
+                continue;
+            cpu_slot s{cpu, node_of[cpu], 0, cpu, 0};
+            auto dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+            read_value(dir + "physical_package_id", s.package);
+            read_value(dir + "core_id", s.core);
+            found.push_back(s);
+        }
+        t.cpus = placement_order(found, t.nodes);
+        t.cpu_limit = cgroup_cpu_limit();
+        return t;
+    }
+
+    // threads worth starting: allowed cpus, rounded up cgroup quota if it's lower
+    size_t default_threads() const {
+        auto n = cpus.size();
+        if (cpu_limit > 0)
+            n = std::min(n, size_t(std::ceil(cpu_limit)));
+        return std::max<size_t>(n, 1);
+    }
+
+    const cpu_slot &place(size_t worker) const { return cpus[worker % cpus.size()]; }
+
+private:
+    /*
+      Round robin over nodes, so n workers get n/nodes nodes' bandwidth each. Inside
+      node first cpu of every physical core goes before its SMT siblings.
+    */
+    static std::vector<cpu_slot> placement_order(std::vector<cpu_slot> found, int nodes) {
+        std::vector<std::vector<cpu_slot>> per_node(nodes);
+        for (auto &s : found) {
+            auto &list = per_node[s.node];
+            s.sibling = int(std::count_if(list.begin(), list.end(), [&](const cpu_slot &o) {
+                return o.package == s.package && o.core == s.core;
+            }));
+            list.push_back(s);
+        }
+        for (auto &list : per_node)
+            std::stable_sort(list.begin(), list.end(), [](const cpu_slot &a, const cpu_slot &b) {
+                return a.sibling < b.sibling;
+            });
+        std::vector<cpu_slot> order;
+        for (size_t i = 0; order.size() < found.size(); i++)
+            for (auto &list : per_node)
+                if (i < list.size())
+                    order.push_back(list[i]);
+        return order;
+    }
+};
+
+// pin calling thread, failure (cpu went offline, affinity changed) leaves it floating
+static inline void pin_current_thread(const cpu_slot &slot) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(slot.cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+  Anonymous buffer mapped by one thread and first-touched by worker which uses it.
+  Default policy already allocates on node of touching cpu, mbind matters when
+  process runs under numactl --interleave or similar.
+*/
+class local_buffer {
+public:
+    explicit local_buffer(size_t size) : size(size) {
+        auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        data = static_cast<char*>(p);
+    }
+    local_buffer(const local_buffer&) = delete;
+    local_buffer& operator=(const local_buffer&) = delete;
+    ~local_buffer() { munmap(data, size); }
+
+    // call from thread pinned to node
+    void touch(const topology &topo, int node) {
+        if (topo.nodes > 1) {
+            unsigned long mask[16] = {};
+            if (node < int(sizeof(mask) * 8)) {
+                mask[node / 64] |= 1ul << (node % 64);
+                syscall(SYS_mbind, data, size, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+            }
+        }
+        auto page = size_t(sysconf(_SC_PAGESIZE));
+        for (size_t i = 0; i < size; i += page)
+            data[i] = 0;
+    }
+
+    char *data;
+    size_t size;
+};
+
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <utility>
+
+/*
+  Block and buffer sizes used by engines.
+
+  Defaults are what was found by hand: 64KB reads (main0: "with small chunks like 256B
+  it's terribly slow"), 32KB index blocks (cpp-7), transform tile which fits L1/L2
+  (main2: buffer must fit L2/L3) and 4MB output batches (output.hpp).
+  revcomp --calibrate measures them for the host and saves them to a config file
+  which later runs load, see calibrate.hpp.
+*/
+
+namespace revcomp {
+
+struct tuning {
+    size_t read_chunk = 1 << 16;    // read() size of stream engine, pread window
+    size_t index_block = 1 << 15;   // pread block of index scan
+    size_t tile = 1 << 16;          // output bytes transformed at once
+    size_t write_batch = 1 << 22;   // output buffer, flushed with one write
+    size_t stream_above = 0;        // mapped output: non-temporal stores for bigger records, 0 = LLC
+    size_t spill_above = 0;         // staged residues per transform thread, 0 = no limit (--max-memory)
+};
+
+struct cache_sizes {
+    size_t l1d = 0, l2 = 0, l3 = 0;
+};
+
+// sysfs size is like "48K" or "2048K"
+static inline size_t parse_size(const std::string &text) {
+    size_t pos;
+    auto value = std::stoull(text, &pos);
+    switch (pos < text.size() ? text[pos] : ' ') {
+        case 'K': case 'k': return value << 10;
+        case 'M': case 'm': return value << 20;
+        case 'G': case 'g': return value << 30;
+        default: return value;
+    }
+}
+
+// back to "64K", "512M" - biggest unit which divides bytes, so parse_size gets them again
+static inline std::string size_text(size_t bytes) {
+    for (auto [shift, unit] : {std::pair{30, "G"}, {20, "M"}, {10, "K"}})
+        if (bytes && bytes % (size_t(1) << shift) == 0)
+            return std::to_string(bytes >> shift) + unit;
+    return std::to_string(bytes);
+}
+
+static inline cache_sizes host_caches() {
+    cache_sizes c;
+    c.l1d = sysconf(_SC_LEVEL1_DCACHE_SIZE) > 0 ? sysconf(_SC_LEVEL1_DCACHE_SIZE) : 0;
+    c.l2 = sysconf(_SC_LEVEL2_CACHE_SIZE) > 0 ? sysconf(_SC_LEVEL2_CACHE_SIZE) : 0;
+    c.l3 = sysconf(_SC_LEVEL3_CACHE_SIZE) > 0 ? sysconf(_SC_LEVEL3_CACHE_SIZE) : 0;
+
+    // glibc reports 0 on some CPUs (e.g. under VMs), sysfs knows better
+    for (int i = 0; i < 8 && (!c.l1d || !c.l2 || !c.l3); i++) {
+        auto dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(i) + "/";
+        std::ifstream level_file(dir + "level"), type_file(dir + "type"), size_file(dir + "size");
+        int level;
+        std::string type, size;
+        if (!(level_file >> level) || !(type_file >> type) || !(size_file >> size))
+            break;
+        if (type == "Instruction")
+            continue;
+        auto bytes = parse_size(size);
+        auto &slot = level == 1 ? c.l1d : level == 2 ? c.l2 : c.l3;
+        if (level <= 3 && !slot)
+            slot = bytes;
+    }
+    if (!c.l1d) c.l1d = 32 << 10;
+    if (!c.l2) c.l2 = 256 << 10;
+    if (!c.l3) c.l3 = 8 << 20;
+    return c;
+}
+
+// $REVCOMP_CONFIG, $XDG_CONFIG_HOME/revcomp.conf or ~/.config/revcomp.conf
+static inline std::string default_config_path() {
+    if (auto p = getenv("REVCOMP_CONFIG"))
+        return p;
+    if (auto p = getenv("XDG_CONFIG_HOME"))
+        return std::string(p) + "/revcomp.conf";
+    if (auto p = getenv("HOME"))
+        return std::string(p) + "/.config/revcomp.conf";
+    return "revcomp.conf";
+}
+
+/*
+  Config is "key = value" per line, # starts a comment. Missing file is fine (defaults),
+  unknown keys are ignored so older binaries read newer configs. save_tuning writes
+  every key read here; stream_above isn't calibrated, it keeps what the config had
+  (0, the default, is written as a comment: 0 is not a valid value).
+*/
+static inline tuning load_tuning(const std::string &path) {
+    tuning t;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        auto eq = line.find('=');
+        if (eq == line.npos)
+            continue;
+        std::istringstream key_stream(line.substr(0, eq)), value_stream(line.substr(eq + 1));
+        std::string key;
+        size_t value;
+        if (!(key_stream >> key) || !(value_stream >> value) || value == 0)
+            throw std::runtime_error(path + ": bad line: " + line);
+        if (key == "read_chunk") t.read_chunk = value;
+        else if (key == "index_block") t.index_block = value;
+        else if (key == "tile") t.tile = value;
+        else if (key == "write_batch") t.write_batch = value;
+        else if (key == "stream_above") t.stream_above = value;
+    }
+    return t;
+}
+
+static inline void save_tuning(const std::string &path, const tuning &t, const cache_sizes &c) {
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("can't write " + path);
+    out << "# revcomp --calibrate, L1d=" << (c.l1d >> 10) << "K L2=" << (c.l2 >> 10)
+        << "K L3=" << (c.l3 >> 10) << "K\n"
+        << "read_chunk = " << t.read_chunk << "\n"
+        << "index_block = " << t.index_block << "\n"
+        << "tile = " << t.tile << "\n"
+        << "write_batch = " << t.write_batch << "\n"
+        << (t.stream_above ? "" : "# ") << "stream_above = " << t.stream_above
+        << (t.stream_above ? "\n" : "  (LLC size)\n");
+    if (!out.flush())
+        throw std::runtime_error("can't write " + path);
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "fasta.hpp"
+
+/*
+  revcomp --validate=fail|warn
+
+  Bytes outside the alphabet (complement_table::valid) are found in the same pass
+  which complements them: with_extras<K, check_alphabet> (kernels.hpp), so the byte set test
+  (vector_in_set from rev4, vpermb in avx512) works on the register that was just
+  loaded and is OR-ed into one mask per call. Only when the mask is not empty the run
+  is scanned again byte by byte for the first bad one, so valid input pays a few
+  vector ops per block and no branches.
+
+  Engines collect what the kernel noted per record (record_extras in record_stats.hpp)
+  and report the first bad residue in input order:
+
+    revcomp: record chr1: byte 0x0d at position 61 is not in the alphabet
+
+  fail throws it, warn prints it to stderr and the residue is complemented to `other`
+  as without --validate. Threaded memory engine reports per job, so a record which
+  is split between jobs may be reported once for each of them. Without --validate
+  engines run plain K and the check compiles to nothing.
+*/
+
+namespace revcomp {
+
+enum class on_invalid { fail, warn };
+
+static inline on_invalid &invalid_policy() {
+    static on_invalid policy = on_invalid::fail;
+    return policy;
+}
+
+// header line ">name description\n" and 0-based residue
+static inline void report_invalid(std::string_view header, size_t residue, uint8_t byte) {
+    char hex[8];
+    snprintf(hex, sizeof hex, "0x%02x", byte);
+    auto message = "record " + std::string(record_name(header)) + ": byte " + hex + " at position " +
+                   std::to_string(residue + 1) + " is not in the alphabet";
+    if (invalid_policy() == on_invalid::fail)
+        throw std::runtime_error(message);
+    fprintf(stderr, "revcomp: warning: %s\n", message.c_str());
+}
+
+}